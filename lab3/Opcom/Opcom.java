@@ -6,101 +6,717 @@ import java.awt.event.*;
 import se.lth.control.*;
 import se.lth.control.plot.*;
 import java.util.*;
+import java.io.*;
+import java.nio.*;
+import java.nio.channels.*;
+import java.util.concurrent.locks.LockSupport;
 import se.lth.control.realtime.*;
 
 
-class PlotData implements Cloneable { 
-    double ref, y; 
-    double x; // holds the current time 
-    
-    public Object clone() { 
-        try { 
-	    return super.clone(); 
-        } catch (Exception e) {return null;} 
-    } 
-} 
+/** Samples (t, ref, y, x, u) handed from the Reader to the PlotFeeder in one piece. */
+class SampleBatch {
+    final double[] t, ref, y, x, u;
+    int n; // number of valid samples
 
+    SampleBatch(int capacity) {
+		  t = new double[capacity];
+		  ref = new double[capacity];
+		  y = new double[capacity];
+		  x = new double[capacity];
+		  u = new double[capacity];
+    }
+}
 
-class Reader extends Thread {
 
-    private Opcom opcom;
+/** Single-producer single-consumer queue of samples in preallocated
+    arrays. The Reader is the only producer and writes only head, the
+    PlotFeeder the only consumer and writes only tail, so neither side
+    locks and no objects are created per sample. The volatile write of
+    head publishes the sample stored before it. When the queue is full
+    the new sample is dropped and counted. */
+class SampleQueue {
+
+    private final int mask;
+    private final double[] t, ref, y, x, u;
+    private volatile long head = 0; // next to write
+    private volatile long tail = 0; // next to read
+    private volatile long dropped = 0;
+
+    /** Constructor. capacity is rounded up to a power of two. */
+    public SampleQueue(int capacity) {
+		  int size = Integer.highestOneBit(Math.max(capacity - 1, 1)) << 1;
+		  mask = size - 1;
+		  t = new double[size];
+		  ref = new double[size];
+		  y = new double[size];
+		  x = new double[size];
+		  u = new double[size];
+    }
 
-    private boolean doIt = true;
+    /** Called by the producer. Returns false if the sample was dropped. */
+    public boolean offer(double t, double ref, double y, double x, double u) {
+		  long h = head;
+		  if (h - tail > mask) {
+				dropped++;
+				return false;
+		  }
+		  int i = (int) h & mask;
+		  this.t[i] = t;
+		  this.ref[i] = ref;
+		  this.y[i] = y;
+		  this.x[i] = x;
+		  this.u[i] = u;
+		  head = h + 1;
+		  return true;
+    }
 
-	 AnalogIn velChan, posChan, ctrlChan;
+    /** Called by the consumer. Moves as many samples as are queued, up
+        to the size of batch, into batch and returns their number. */
+    public int drain(SampleBatch batch) {
+		  long tl = tail;
+		  int n = (int) Math.min(head - tl, batch.t.length);
+		  for (int k = 0; k < n; k++) {
+				int i = (int) (tl + k) & mask;
+				batch.t[k] = t[i];
+				batch.ref[k] = ref[i];
+				batch.y[k] = y[i];
+				batch.x[k] = x[i];
+				batch.u[k] = u[i];
+		  }
+		  batch.n = n;
+		  tail = tl + n;
+		  return n;
+    }
+
+    /** Number of samples that can be offered without a drop. Called by
+        the producer. */
+    public int space() {
+		  return (int) (mask + 1 - (head - tail));
+    }
 
-    /** Constructor. Sets initial values of the controller parameters and initial mode. */
-    public Reader(Opcom opcom) {
+    /** Number of samples dropped because the consumer fell behind. */
+    public long dropped() {
+		  return dropped;
+    }
 
-		  this.opcom = opcom;
+    /** Number of samples queued so far, not counting the dropped ones. */
+    public long queued() {
+		  return head;
+    }
+}
+
+
+/** A thread that fills the plot queue: the Reader, the
+    TelemetryReader or the CaptureReplay. */
+interface Acquisition {
+    /** Stops the thread and waits until it has queued its last sample. */
+    void shutDown();
+}
+
+
+/** Acquisition with AnalogIn: samples the measured input of the
+    controller, AD channel yChannel (Capture.VELOCITY or
+    Capture.POSITION), the other input and the control signal. There
+    is no reference, so it is queued as NaN; y and u mean the same as
+    those of the TelemetryReader, and x is the other input. */
+class Reader extends Thread implements Acquisition {
+
+    private SampleQueue queue;
+    private long period; // ns
+    private int yChannel;
+
+    private volatile boolean doIt = true;
+    private volatile long overruns = 0;
+
+	 AnalogIn yChan, xChan, ctrlChan;
+
+    /** Constructor. period is the sampling period in ns. */
+    public Reader(SampleQueue queue, long period, int yChannel) {
+
+		  this.queue = queue;
+		  this.period = period;
+		  this.yChannel = yChannel;
 
     }
 
-    /** Run method. Sends data periodically to Opcom. */
+    /** Run method. Samples periodically into the queue. The sample
+        times are absolute, k * period from the start on the monotonic
+        clock, so the sampling does not drift with the time it takes to
+        read the inputs. A sample that is more than a period late is
+        skipped, and counted, rather than taken in a burst. */
     public void run() {
-		  final long h = 25; // period (ms)
-		  long duration;
-		  long t = System.currentTimeMillis();
-		  DoublePoint dp;
-		  PlotData pd;
-		  double vel = 0, pos = 0, ctrl = 0;
-		  double realTime = 0;
+		  final double h = period / 1e9; // period (s)
+		  long next = System.nanoTime();
+		  long k = 0;
+		  long wait;
+		  double y = 0, x = 0, ctrl = 0;
 
 		  try {
-				velChan = new AnalogIn(0);
-				posChan = new AnalogIn(1);
+				yChan = new AnalogIn(yChannel);
+				xChan = new AnalogIn(Capture.other(yChannel));
 				ctrlChan = new AnalogIn(2);
 		  } catch (Exception e) {
 				System.out.println(e);
-		  } 
+		  }
 
 		  setPriority(7);
 
 		  while (doIt) {
 				try {
-					 vel = velChan.get();
-					 pos = posChan.get();
+					 y = yChan.get();
+					 x = xChan.get();
 					 ctrl = ctrlChan.get();
 				} catch (Exception e) {
 					 System.out.println(e);
-				} 
-
-				pd = new PlotData();
-				pd.y = vel;
-				pd.ref = pos;
-				pd.x = realTime;
-				opcom.putMeasurementDataPoint(pd);
-	    
-				dp = new DoublePoint(realTime,ctrl);
-				opcom.putControlDataPoint(dp);
-
-				realTime += ((double) h)/1000.0;
-
-				t += h;
-				duration = (int) (t - System.currentTimeMillis());
-				if (duration > 0) {
-					 try {
-						  sleep(duration);
-					 } catch (Exception e) {}
+				}
+
+				queue.offer(k * h, Double.NaN, y, x, ctrl);
+
+				k++;
+				next += period;
+				wait = next - System.nanoTime();
+				if (wait < -period) {
+					 long missed = -wait / period;
+					 overruns += missed;
+					 k += missed;
+					 next += missed * period;
+				}
+				while ((wait = next - System.nanoTime()) > 0) {
+					 LockSupport.parkNanos(wait);
 				}
 		  }
     }
 
+    /** Number of sampling instants skipped because the Reader was late. */
+    public long overruns() {
+		  return overruns;
+    }
+
     /** Stops the thread. */
     private void stopThread() {
 		  doIt = false;
     }
 
-    /** Called by Opcom when the Stop button is pressed. */
-    public synchronized void shutDown() {
+    /** Called by Opcom at shutdown. Waits at most a period. */
+    public void shutDown() {
 		  stopThread();
-    } 
+		  try {
+				join();
+		  } catch (InterruptedException e) {}
+    }
 
 }
 
 
+/** Decoder for the binary telemetry stream of the controllers
+    (telemetry.h), frames of refproto.h:
+
+      0xa5 0x5a  command(1)  length(1)  payload(length)  checksum(1)
+
+    Telemetry has command TELEMETRY_CMD_DATA and the payload index(2)
+    followed by records. A record is seven little-endian int16: Y, r,
+    u and four states. The decoder is fed bytes as they arrive and
+    resynchronizes on the sync pair. Frames with another command, the
+    replies to parameter commands, are skipped by their length and
+    not counted as bad; telemetry frames with a bad length or checksum
+    are dropped and counted. Text replies to commands in between are
+    skipped. */
+class TelemetryDecoder {
+
+    static final int TELEMETRY_CMD_DATA = 16; // refproto.h
+    static final int RECORD = 14;
+
+    private final byte[] buf = new byte[4 + 255 + 1];
+    private int fill = 0;   // bytes of the current frame
+    private int length = 0; // length of the current frame, once known
+    private int lastIndex = -1;
+    private long sample = 0; // sample number, index extended past 16 bits
+    private long badFrames = 0;
+    private long otherFrames = 0;
+
+    /** Called for each record of a good frame with its sample number. */
+    interface Sink {
+		  void record(long sample, int y, int r, int u);
+    }
+
+    private static int word(byte[] b, int i) {
+		  return (short) ((b[i] & 0xff) | (b[i + 1] << 8));
+    }
+
+    /** Decodes n bytes from b, passing the records to sink. */
+    public void put(byte[] b, int n, Sink sink) {
+		  for (int i = 0; i < n; i++) {
+				byte c = b[i];
+				if (fill == 0) {
+					 if (c == (byte) 0xa5) buf[fill++] = c;
+					 continue;
+				}
+				if (fill == 1) {
+					 if (c == (byte) 0x5a) buf[fill++] = c;
+					 else fill = c == (byte) 0xa5 ? 1 : 0;
+					 continue;
+				}
+				buf[fill++] = c;
+				if (fill == 4) {
+					 int len = buf[3] & 0xff;
+					 if (buf[2] == TELEMETRY_CMD_DATA
+						  && (len < 2 + RECORD || (len - 2) % RECORD != 0)) {
+						  badFrames++;
+						  fill = 0;
+						  continue;
+					 }
+					 length = 4 + len + 1;
+				}
+				if (fill > 4 && fill == length) {
+					 if (buf[2] == TELEMETRY_CMD_DATA) frame(sink);
+					 else otherFrames++;
+					 fill = 0;
+				}
+		  }
+    }
+
+    private void frame(Sink sink) {
+		  int sum = 0;
+		  for (int i = 2; i < length - 1; i++) sum += buf[i];
+		  if ((byte) sum != buf[length - 1]) {
+				badFrames++;
+				return;
+		  }
+		  int index = word(buf, 4) & 0xffff;
+		  if (lastIndex >= 0) sample += (index - lastIndex) & 0xffff;
+		  else sample = index;
+		  int count = ((buf[3] & 0xff) - 2) / RECORD;
+		  for (int k = 0; k < count; k++) {
+				int p = 6 + k * RECORD;
+				sink.record(sample + k, word(buf, p), word(buf, p + 2), word(buf, p + 4));
+		  }
+		  lastIndex = index;
+    }
+
+    /** Number of telemetry frames dropped for a bad length or checksum. */
+    public long badFrames() {
+		  return badFrames;
+    }
+
+    /** Number of frames of other commands skipped. */
+    public long otherFrames() {
+		  return otherFrames;
+    }
+}
+
+
+/** Acquisition from the controller's own samples: reads the telemetry
+    stream from the serial port and queues every record, time-stamped
+    by its sample index, so the plots show exactly what the controller
+    computed at its own rate: r is its reference and y the input it
+    measures, the position or the velocity. The port is read as a file,
+    so set it up
+    first, e.g.
+      stty -F /dev/ttyS0 38400 raw -echo
+    With start set, 'b' is sent to switch the stream on, and again at
+    shutdown to switch it off. The port is opened, read, and closed by
+    run() alone. */
+class TelemetryReader extends Thread implements TelemetryDecoder.Sink, Acquisition {
+
+    private static final double VOLT = 10.0 / 512; // V per AD or PWM unit
+
+    private SampleQueue queue;
+    private String port;
+    private double h; // controller sampling period (s)
+    private boolean start;
+    private TelemetryDecoder decoder = new TelemetryDecoder();
+
+    private volatile boolean doIt = true;
+
+    /** Constructor. period is the controller's sampling period in ns. */
+    public TelemetryReader(SampleQueue queue, String port, long period, boolean start) {
+		  this.queue = queue;
+		  this.port = port;
+		  this.h = period / 1e9;
+		  this.start = start;
+    }
+
+    public void record(long sample, int y, int r, int u) {
+		  queue.offer(sample * h, r * VOLT, y * VOLT, Double.NaN, u * VOLT);
+    }
+
+    /** Run method. Decodes the stream until shut down, then switches
+        it off if it was started, and closes the port. The port is read
+        through its channel, so that an interrupt ends a read that waits
+        for a byte that does not come. */
+    public void run() {
+		  byte[] b = new byte[256];
+		  ByteBuffer bb = ByteBuffer.wrap(b);
+		  RandomAccessFile file = null;
+		  int n;
+
+		  try {
+				file = new RandomAccessFile(port, "rw");
+				FileChannel channel = file.getChannel();
+				if (start) file.write('b');
+				while (doIt && (n = channel.read(bb)) >= 0) {
+					 decoder.put(b, n, this);
+					 bb.clear();
+				}
+		  } catch (IOException e) {
+				if (doIt) System.out.println(e);
+		  } finally {
+				if (file != null) {
+					 try {
+						  if (start && file.getChannel().isOpen()) file.write('b');
+					 } catch (IOException e) {}
+					 try {
+						  file.close();
+					 } catch (IOException e) {}
+				}
+		  }
+    }
+
+    /** Number of frames dropped for a bad length or checksum. */
+    public long badFrames() {
+		  return decoder.badFrames();
+    }
+
+    /** Stops the thread, and the stream if it was started, and waits
+        until the port is closed. A running stream ends the read within
+        a frame; if nothing arrives for a second, the read is
+        interrupted, which closes the channel, so 'b' is not sent then:
+        a stream that sends nothing is not on. */
+    public void shutDown() {
+		  doIt = false;
+		  try {
+				join(1000);
+				if (isAlive()) {
+					 interrupt();
+					 join();
+				}
+		  } catch (InterruptedException e) {}
+    }
+
+}
+
+
+
+/** Capture files: the samples (t, ref, y, x, u) in columns, append-only.
+
+      header  "OCAP"  version(4)  chunk(4)  channel(4)
+      chunk   n(4)  0(4)  t * n (double)  ref * n  y * n  x * n  u * n (float)
+
+    All little-endian. The columns mean the same for every source: ref
+    is the reference, NaN if the source does not have it (AnalogIn), y
+    the measured input of the controller, x the other input, NaN if
+    the source does not have it (telemetry), and u the control signal,
+    all in V. channel says which input y is, VELOCITY or POSITION, the
+    AD channel numbers of the controllers (CTRL_INPUT). A chunk holds up
+    to chunk samples; the last one, or one written early so that
+    little is lost if Opcom dies, can hold fewer. A chunk cut short at
+    the end of the file is ignored. */
+class Capture {
+
+    static final int MAGIC = 0x5041434f; // "OCAP" little-endian
+    static final int VERSION = 3;
+    static final int HEADER = 16;
+    static final int VELOCITY = 0;
+    static final int POSITION = 1;
+
+    static String name(int channel) {
+		  return channel == VELOCITY ? "velocity" : "position";
+    }
+
+    /** The input that is not channel. */
+    static int other(int channel) {
+		  return channel == VELOCITY ? POSITION : VELOCITY;
+    }
+
+    /** Bytes of a chunk of n samples. */
+    static int chunkBytes(int n) {
+		  return 8 + n * (8 + 4 * 4);
+    }
+}
+
+
+/** Thread that writes the samples from its queue to a capture file.
+    The PlotFeeder fills the queue, so neither the acquisition nor the
+    plots ever wait for the disk: if the writer falls behind, samples
+    are dropped and counted by the queue. A chunk is written when it is
+    full or a second after its first sample. */
+class CaptureWriter extends Thread {
+
+    private static final int CHUNK = 1024;
+
+    private SampleQueue queue;
+    private SampleBatch batch = new SampleBatch(256);
+    private FileChannel channel;
+    private ByteBuffer out = ByteBuffer.allocateDirect(Capture.chunkBytes(CHUNK)).order(ByteOrder.LITTLE_ENDIAN);
+    private double[] t = new double[CHUNK];
+    private float[] ref = new float[CHUNK], y = new float[CHUNK], x = new float[CHUNK];
+    private float[] u = new float[CHUNK];
+    private int n = 0;
+    private long firstNs;
+
+    private volatile boolean doIt = true;
+
+    /** Constructor. Creates the file and writes the header; yChannel
+        is the input in the y column. */
+    public CaptureWriter(SampleQueue queue, String name, int yChannel) throws IOException {
+		  this.queue = queue;
+		  channel = new FileOutputStream(name).getChannel();
+		  out.putInt(Capture.MAGIC).putInt(Capture.VERSION).putInt(CHUNK).putInt(yChannel);
+		  out.flip();
+		  while (out.hasRemaining()) channel.write(out);
+    }
+
+    /** Run method. Drains the queue every 100 ms; at shutdown, drains
+        it once more and writes the last chunk. */
+    public void run() {
+		  try {
+				while (doIt) {
+					 drain();
+					 try {
+						  sleep(100);
+					 } catch (InterruptedException e) {}
+				}
+				drain();
+				flush();
+				channel.close();
+		  } catch (IOException e) {
+				System.out.println(e);
+		  }
+    }
+
+    private void drain() throws IOException {
+		  while (queue.drain(batch) > 0) {
+				for (int i = 0; i < batch.n; i++) {
+					 if (n == 0) firstNs = System.nanoTime();
+					 t[n] = batch.t[i];
+					 ref[n] = (float) batch.ref[i];
+					 y[n] = (float) batch.y[i];
+					 x[n] = (float) batch.x[i];
+					 u[n] = (float) batch.u[i];
+					 if (++n == CHUNK) flush();
+				}
+		  }
+		  if (n > 0 && System.nanoTime() - firstNs > 1000000000L) flush();
+    }
+
+    private void flush() throws IOException {
+		  if (n == 0) return;
+		  out.clear();
+		  out.putInt(n).putInt(0);
+		  for (int i = 0; i < n; i++) out.putDouble(t[i]);
+		  for (int i = 0; i < n; i++) out.putFloat(ref[i]);
+		  for (int i = 0; i < n; i++) out.putFloat(y[i]);
+		  for (int i = 0; i < n; i++) out.putFloat(x[i]);
+		  for (int i = 0; i < n; i++) out.putFloat(u[i]);
+		  out.flip();
+		  while (out.hasRemaining()) channel.write(out);
+		  n = 0;
+    }
+
+    /** Stops the thread and waits until the file is complete. */
+    public void shutDown() {
+		  doIt = false;
+		  try {
+				join();
+		  } catch (InterruptedException e) {}
+    }
+
+}
+
+
+/** Thread that plays a capture file into the plot queue, in place of
+    the acquisition, at speed times real time. The file is memory-mapped
+    and read column by column, so a capture of any length is replayed
+    without reading it in first. */
+class CaptureReplay extends Thread implements Acquisition {
+
+    private SampleQueue queue;
+    private String name;
+    private double speed;
+
+    private volatile boolean doIt = true;
+
+    /** Constructor. speed 1 is real time, 2 twice as fast and so on. */
+    public CaptureReplay(SampleQueue queue, String name, double speed) {
+		  this.queue = queue;
+		  this.name = name;
+		  this.speed = speed;
+    }
+
+    /** Maps a capture file and checks its header. */
+    static ByteBuffer map(String name) throws IOException {
+		  FileChannel channel = new FileInputStream(name).getChannel();
+		  ByteBuffer b = channel.map(FileChannel.MapMode.READ_ONLY, 0, channel.size());
+		  channel.close();
+		  b.order(ByteOrder.LITTLE_ENDIAN);
+		  if (b.limit() < Capture.HEADER || b.getInt(0) != Capture.MAGIC
+				|| b.getInt(4) != Capture.VERSION) {
+				throw new IOException(name + ": not a capture file of version " + Capture.VERSION);
+		  }
+		  return b;
+    }
+
+    /** The input in the y column of a mapped capture. */
+    static int channel(ByteBuffer b) {
+		  return b.getInt(12);
+    }
+
+    /** Run method. Queues every sample at its time, waiting for room
+        in the queue rather than dropping when replaying fast. */
+    public void run() {
+		  ByteBuffer b;
+		  try {
+				b = map(name);
+		  } catch (IOException e) {
+				System.out.println(e);
+				return;
+		  }
+
+		  long startNs = System.nanoTime();
+		  double t0 = Double.NaN;
+		  int pos = Capture.HEADER;
+		  while (doIt && pos + 8 <= b.limit()) {
+				int n = b.getInt(pos);
+				if (n <= 0 || pos + Capture.chunkBytes(n) > b.limit()) break;
+				int tp = pos + 8, rp = tp + 8 * n, yp = rp + 4 * n, xp = yp + 4 * n, up = xp + 4 * n;
+				for (int i = 0; doIt && i < n; i++) {
+					 double t = b.getDouble(tp + 8 * i);
+					 if (Double.isNaN(t0)) t0 = t;
+					 long due = startNs + (long) ((t - t0) / speed * 1e9);
+					 long wait;
+					 while (doIt && ((wait = due - System.nanoTime()) > 0 || queue.space() == 0)) {
+						  LockSupport.parkNanos(wait > 0 ? Math.min(wait, 100000000L) : 1000000);
+					 }
+					 if (!doIt) break;
+					 queue.offer(t, b.getFloat(rp + 4 * i), b.getFloat(yp + 4 * i),
+									 b.getFloat(xp + 4 * i), b.getFloat(up + 4 * i));
+				}
+				pos += Capture.chunkBytes(n);
+		  }
+    }
+
+    /** Writes y of a capture as int16 AD values with 2 fractional bits
+        (ADC_FRAC_BITS in adc.h), the input file of servosim -i, so that a
+        recorded run can be fed to the controllers on the host. yChannel
+        is the input of the target controller, or -1 for whatever the
+        capture holds; a capture of the other input is refused. */
+    static void export(String name, String outName, int yChannel) throws IOException {
+		  ByteBuffer b = map(name);
+		  int have = channel(b);
+		  if (yChannel >= 0 && have != yChannel) {
+				throw new IOException(name + ": y is the " + Capture.name(have)
+											 + ", not the " + Capture.name(yChannel));
+		  }
+		  DataOutputStream out = new DataOutputStream(new BufferedOutputStream(new FileOutputStream(outName)));
+		  int pos = Capture.HEADER;
+		  while (pos + 8 <= b.limit()) {
+				int n = b.getInt(pos);
+				if (n <= 0 || pos + Capture.chunkBytes(n) > b.limit()) break;
+				int yp = pos + 8 + 12 * n;
+				for (int i = 0; i < n; i++) {
+					 long q = Math.round(b.getFloat(yp + 4 * i) * 512 / 10.0 * 4);
+					 short s = (short) Math.max(-2048, Math.min(2047, q));
+					 out.writeByte(s & 0xff);
+					 out.writeByte((s >> 8) & 0xff);
+				}
+				pos += Capture.chunkBytes(n);
+		  }
+		  out.close();
+    }
+
+    /** Stops the thread and waits for it, at most 100 ms. */
+    public void shutDown() {
+		  doIt = false;
+		  try {
+				join();
+		  } catch (InterruptedException e) {}
+    }
+
+}
+
+
+
+/** Thread that drains the queue every interval ms and feeds the
+    samples to the plotters, so that the Reader never waits for the
+    GUI. The batch is what it takes from the queue at a time; the
+    plotters still get one putData() per sample. If capture is set, it
+    also passes the samples on to a CaptureWriter through that
+    queue. At shutdown it drains the queue once more, so that every
+    sample the acquisition queued reaches the capture. */
+class PlotFeeder extends Thread {
+
+    private Opcom opcom;
+    private SampleQueue queue;
+    private SampleBatch batch;
+    private long interval; // ms
+    private SampleQueue capture;
+
+    private volatile boolean doIt = true;
+
+    /** Constructor. The batch holds up to batchSize samples. */
+    public PlotFeeder(Opcom opcom, SampleQueue queue, int batchSize, long interval,
+                      SampleQueue capture) {
+		  this.opcom = opcom;
+		  this.queue = queue;
+		  this.batch = new SampleBatch(batchSize);
+		  this.interval = interval;
+		  this.capture = capture;
+    }
+
+    /** Run method. Drains the queue, then waits for the next interval;
+        drains it a last time when stopped, for the capture only, since
+        the plotters may be stopped by then. */
+    public void run() {
+		  while (doIt) {
+				drain(true);
+				try {
+					 sleep(interval);
+				} catch (InterruptedException e) {}
+		  }
+		  drain(false);
+    }
+
+    private void drain(boolean plot) {
+		  while (queue.drain(batch) > 0) {
+				if (plot) opcom.putSamples(batch);
+				if (capture != null) {
+					 for (int i = 0; i < batch.n; i++) {
+						  capture.offer(batch.t[i], batch.ref[i], batch.y[i], batch.x[i],
+											 batch.u[i]);
+					 }
+				}
+		  }
+    }
+
+    /** Stops the thread and waits until the last samples are passed on.
+        Call it after the acquisition has stopped. */
+    public void shutDown() {
+		  doIt = false;
+		  try {
+				join();
+		  } catch (InterruptedException e) {}
+    }
+
+}
+
+
+
 /** Class that creates and maintains a GUI for the Ball and Beam process. 
-	 Uses two internal threads to update plotters */
+	 Uses two internal threads to update plotters
+
+	 The class files are built, not kept in git. To compile and run,
+	 from this directory, with the se.lth.control packages (plot,
+	 realtime) of the lab computers on the class path:
+	   javac -cp .:$CLASSPATH Opcom.java
+	   java -cp .:$CLASSPATH Opcom [arguments, see main]
+
+	 When it exits, Opcom prints how many samples were queued, how many
+	 the Reader skipped because it was late and how many the plot and
+	 capture queues dropped. To check that the GUI keeps up, run it for
+	 a minute at 25 ms and at 1 ms, e.g.
+	   java -cp .:$CLASSPATH Opcom 1
+	 and close the window. The counts should be zero at either period,
+	 or a few from the start, while the JIT compiles. */
 
 public class Opcom {    
 
@@ -147,7 +763,7 @@ public class Opcom {
 		  // Create plot components and axes, add to plotterPanel.
 		  measurementPlotter.setYAxis(20, -10, 4, 4);
 		  measurementPlotter.setXAxis(range, divTicks, divGrid);
-		  measurementPlotter.setTitle("Position and velocity (V)");
+		  measurementPlotter.setTitle("Reference, or other input, and measured input (V)");
 		  plotterPanel.add(measurementPlotter);
 		  plotterPanel.addFixed(10);
 		  controlPlotter.setYAxis(20, -10, 4, 4);
@@ -181,27 +797,113 @@ public class Opcom {
 		  frame.setVisible(true);
     }
 
-    /** Called by Reader to put a control signal data point in the buffer. */
-    public synchronized void putControlDataPoint(DoublePoint dp) {
-		  double x = dp.x;
-		  double y = dp.y;
-		  controlPlotter.putData(x, y);
+    /** Called by the PlotFeeder with the samples it drained. A
+        PlotterPanel takes one point per putData() call, so this is one
+        call per sample and panel, at the panel's own cost; what the
+        queue saves is the allocation and the synchronized hand-over
+        per sample of the old Reader. */
+    public void putSamples(SampleBatch b) {
+		  for (int i = 0; i < b.n; i++) {
+				double ref = Double.isNaN(b.ref[i]) ? b.x[i] : b.ref[i]; // none from AnalogIn
+				measurementPlotter.putData(b.t[i], ref, b.y[i]);
+				controlPlotter.putData(b.t[i], b.u[i]);
+		  }
     }
-    
-    /** Called by Reader to put a measurement data point in the buffer. */
-    public synchronized void putMeasurementDataPoint(PlotData pd) {
-		  double x = pd.x;
-		  double ref = pd.ref;
-		  double y = pd.y;
-		  measurementPlotter.putData(x, ref, y);
-    }    
-
-	 public static void main(String[] argv) {
+
+	 /** Arguments:
+		  [-v | -p] [period ms, default 25]
+		                              sample the AnalogIn channels, the
+		                              velocity (-v) or the position (-p,
+		                              the default) as the measured input
+		  -t port [-b] [-v | -p] [period ms, default 50]
+		                              plot the controller's telemetry from
+		                              the serial port, sent every period;
+		                              -b switches the stream on and off,
+		                              -v or -p says which input the
+		                              controller measures, for -c
+		  -r capture [-s speed]       replay a capture file instead, at
+		                              speed times real time (default 1)
+		  -c capture                  also record the samples to a
+		                              capture file
+		  -x capture input [-v | -p]  no GUI: write y of a capture as
+		                              an input file for servosim -i,
+		                              checking that y is the velocity or
+		                              the position if given */
+	 public static void main(String[] argv) throws IOException {
+		  String port = null, replay = null, record = null, exportFrom = null, exportTo = null;
+		  boolean startStream = false;
+		  int yChannel = -1;
+		  double periodMs = 0, speed = 1;
+		  for (int i = 0; i < argv.length; i++) {
+				if (argv[i].equals("-t") && i + 1 < argv.length) port = argv[++i];
+				else if (argv[i].equals("-b")) startStream = true;
+				else if (argv[i].equals("-v")) yChannel = Capture.VELOCITY;
+				else if (argv[i].equals("-p")) yChannel = Capture.POSITION;
+				else if (argv[i].equals("-r") && i + 1 < argv.length) replay = argv[++i];
+				else if (argv[i].equals("-s") && i + 1 < argv.length) speed = Double.parseDouble(argv[++i]);
+				else if (argv[i].equals("-c") && i + 1 < argv.length) record = argv[++i];
+				else if (argv[i].equals("-x") && i + 2 < argv.length) {
+					 exportFrom = argv[++i];
+					 exportTo = argv[++i];
+				}
+				else periodMs = Double.parseDouble(argv[i]);
+		  }
+		  if (exportFrom != null) {
+				CaptureReplay.export(exportFrom, exportTo, yChannel);
+				return;
+		  }
+		  if (replay != null) yChannel = CaptureReplay.channel(CaptureReplay.map(replay));
+		  else if (yChannel < 0) yChannel = Capture.POSITION;
+		  if (periodMs <= 0) periodMs = port == null ? 25.0 : 50.0;
+		  long period = Math.round(periodMs * 1e6);
+
+		  SampleQueue queue = new SampleQueue(4096);
+		  SampleQueue captureQueue = null;
+		  CaptureWriter writer = null;
+		  if (record != null) {
+				captureQueue = new SampleQueue(16384);
+				writer = new CaptureWriter(captureQueue, record, yChannel);
+		  }
 		  Opcom opcom = new Opcom();
 		  opcom.initializeGUI();
-		  Reader reader = new Reader(opcom);
+		  Acquisition acquisition;
+		  if (replay != null) {
+				acquisition = new CaptureReplay(queue, replay, speed);
+		  } else if (port == null) {
+				acquisition = new Reader(queue, period, yChannel);
+		  } else {
+				acquisition = new TelemetryReader(queue, port, period, startStream);
+		  }
+		  PlotFeeder feeder = new PlotFeeder(opcom, queue, 256, 20, captureQueue);
+		  shutDownInOrder(acquisition, queue, feeder, captureQueue, writer);
+		  if (writer != null) writer.start();
 		  opcom.start();
-		  reader.start();
+		  feeder.start();
+		  ((Thread) acquisition).start();
+	 }
+
+	 /** At exit, stops the threads in the order the samples flow: the
+		  acquisition, then the feeder, which passes the last samples of
+		  the queue on to the capture queue, then the writer, which drains
+		  that and completes the file, and prints what was lost on the
+		  way. captureQueue and writer may be null. */
+	 private static void shutDownInOrder(final Acquisition acquisition, final SampleQueue queue,
+													 final PlotFeeder feeder, final SampleQueue captureQueue,
+													 final CaptureWriter writer) {
+		  Runtime.getRuntime().addShutdownHook(new Thread() {
+					 public void run() {
+						  acquisition.shutDown();
+						  feeder.shutDown();
+						  if (writer != null) writer.shutDown();
+						  String s = "Opcom: " + queue.queued() + " samples, "
+								+ queue.dropped() + " dropped by the plot queue";
+						  if (acquisition instanceof Reader)
+								s += ", " + ((Reader) acquisition).overruns() + " skipped by the Reader";
+						  if (captureQueue != null)
+								s += ", " + captureQueue.dropped() + " dropped by the capture queue";
+						  System.out.println(s);
+					 }
+				});
 	 }
 
 }
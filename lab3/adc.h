@@ -0,0 +1,100 @@
+/**
+ * Background AD conversion with oversampling.
+ *
+ * The ADC converts continuously from its conversion-complete interrupt,
+ * going round the ADC_CHANNELS channels in turn: channel 0 (velocity)
+ * and channel 1 (position) of each axis (AXIS_INPUT in hal.h). With
+ * the clock/128 ADC prescaler that is about 8800 conversions per
+ * second (ADC_CONV_NS each), 4400 per channel with one axis. Every
+ * ADC_OVERSAMPLE conversions of a channel are summed and decimated to
+ * one value with ADC_FRAC_BITS fractional bits.
+ *
+ * ADC_OVERSAMPLE follows from SAMPLE_MS and AXES: the largest of 16, 8
+ * and 4 whose window, the time it takes to collect one value of a
+ * channel, is at most half the sample period. Every control period
+ * then reads a value that is younger than one period, and the window
+ * adds at most a quarter period of averaging lag. With one axis that
+ * is 16 (3.6 ms) down to 10 ms, 8 (1.8 ms) at 5 ms and 4 (0.9 ms) at
+ * 2 ms; with two axes 16 (7.2 ms) at 20 ms and longer. Fewer than 16
+ * conversions give fewer than ADC_FRAC_BITS bits of real resolution,
+ * but the values keep their format. A period too short for a window of
+ * 4 that at least fits within it is refused.
+ *
+ * Each channel has a double buffer: the interrupt writes the slot that
+ * is not current and then flips the index, so a reader always gets a
+ * complete, recent value without waiting for a conversion. The
+ * conversion interrupt takes roughly 3% of the CPU.
+ */
+
+#ifndef ADC_H
+#define ADC_H
+
+#include <inttypes.h>
+#include "sampling.h"
+
+#define ADC_FRAC_BITS  2
+#define ADC_CHANNELS   (2 * AXES)
+#define ADC_CONV_NS    112848L      /* 13 ADC clocks of 14745600/128 Hz */
+
+/* Time to collect 2^bits conversions of every channel, ns */
+#define ADC_WINDOW_NS(bits) ((ADC_CHANNELS << (bits)) * ADC_CONV_NS)
+
+#if ADC_WINDOW_NS(4) <= SAMPLE_MS * 500000L
+#define ADC_OVERSAMPLE_BITS 4
+#elif ADC_WINDOW_NS(3) <= SAMPLE_MS * 500000L
+#define ADC_OVERSAMPLE_BITS 3
+#elif ADC_WINDOW_NS(2) <= SAMPLE_MS * 1000000L || defined(HOST)
+#define ADC_OVERSAMPLE_BITS 2       /* host tools may run more axes */
+#else
+#error "The AD conversions cannot give every channel a new value each SAMPLE_MS"
+#endif
+
+#define ADC_OVERSAMPLE (1 << ADC_OVERSAMPLE_BITS)
+#define ADC_DECIMATE   (ADC_OVERSAMPLE_BITS - ADC_FRAC_BITS)  /* right shift of the sum */
+
+static volatile int16_t adc_value[ADC_CHANNELS][2];  /* [channel][slot], ADC_FRAC_BITS fraction */
+static volatile uint8_t adc_slot[ADC_CHANNELS];      /* current slot per channel */
+static uint16_t adc_acc[ADC_CHANNELS];
+static uint8_t adc_count[ADC_CHANNELS];
+static uint8_t adc_chan = 0;
+
+/**
+ * Start background conversions. Replaces ADCSRA = 0xc7 in main().
+ */
+static inline void adc_init(void) {
+  ADMUX = 0xc0;                     /* Internal reference, channel 0 */
+  ADCSRA = 0xcf;                    /* ADC enable + start + interrupt + prescaling */
+}
+
+/**
+ * Latest decimated value of a channel, [-512..511] with ADC_FRAC_BITS
+ * fractional bits
+ */
+static inline int16_t adc_latest(uint8_t chan) {
+  return adc_value[chan][adc_slot[chan]];
+}
+
+/**
+ * Interrupt handler for AD conversion complete. Starts the conversion
+ * on the next channel first, then accumulates the result.
+ */
+ISR(ADC_vect){
+  uint8_t chan = adc_chan;
+  uint16_t x = ADC;
+
+  adc_chan = chan + 1 < ADC_CHANNELS ? chan + 1 : 0;
+  ADMUX = 0xc0 + adc_chan;
+  ADCSRA |= 0x40;                   /* Start the next conversion */
+
+  adc_acc[chan] += x;
+  if (++adc_count[chan] == ADC_OVERSAMPLE) {
+    uint8_t slot = adc_slot[chan] ^ 1;
+    adc_value[chan][slot] = (int16_t) ((adc_acc[chan] + ((1 << ADC_DECIMATE) >> 1))
+                                       >> ADC_DECIMATE) - (512 << ADC_FRAC_BITS);
+    adc_slot[chan] = slot;
+    adc_acc[chan] = 0;
+    adc_count[chan] = 0;
+  }
+}
+
+#endif
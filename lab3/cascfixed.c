@@ -0,0 +1,175 @@
+/**
+ * Cascade position control, in fixed point: an inner velocity PI on
+ * channel 0, built like velfixed.c, and an outer position loop with
+ * the state feedback of posfixed.c,
+ *   vref = kr r - k1 vel - k2 pos
+ * that gives the inner loop its velocity reference. The board program
+ * is in controller.h.
+ *
+ * Both channels are read on every control sample. The inner loop runs
+ * at the sample period, 10 ms by default, and the outer loop on every
+ * CASC_DIV-th sample, 50 ms by default, like the position controller.
+ * Since both states are measured, the outer loop needs no observer,
+ * and a load disturbance is taken out by the inner integral at the
+ * inner loop bandwidth (coeffs.h) instead of by the disturbance
+ * estimate of posfixed.c. host/coeffgen.c places the outer poles with
+ * the pole placement of the position controller, for the inner loop
+ * taken as a first-order lag. The velocity reference is limited to
+ * +-CASC_VMAX, inside the range of the velocity input.
+ *
+ * The inner PI has no set-point weighting (b = 1), since vref is
+ * already shaped by the outer loop, and its anti-windup tracking time
+ * constant is Ti. Back-calculation then reduces to
+ *   I = I + h/Ti (u - I)
+ * with u the limited output: unsaturated this is the usual
+ * I + K h/Ti (vref - vel), saturated the integral follows the output
+ * instead of winding up. The high inner gain does not fit the usual
+ * back-calculation in 16 bits, since the unlimited output can exceed
+ * the limits many times over, but this form never leaves the output
+ * range.
+ *
+ * A sample needs two multiplications, plus three for the outer loop,
+ * against ten for posfixed.c, so at five times the rate the cascade
+ * takes about the same CPU time as the position controller, well
+ * under 1% (measure with -DPROFILE). In servosim a 510 step settles
+ * to within 5 in 0.8 s instead of 1.0 s, without overshoot, and a
+ * load step of 30 moves the position by less than 1 instead of 14.
+ *
+ * Build with -DSAMPLE_MS=10 (the default here), 5 or 2. It drives one
+ * axis only: with AXES=2 every axis needs a tick of its own, and at
+ * these periods there is one tick per sample (sampling.h).
+ */
+
+#ifndef SAMPLE_MS
+#define SAMPLE_MS 10
+#endif
+
+#include <inttypes.h>
+#include "hal.h"
+#include "satcount.h"
+#include "fixedpoint.h"
+#include "sampling.h"
+#include "coeffs.h"
+
+#if SAMPLE_MS > 10
+#error "The cascade inner loop needs SAMPLE_MS of 10 or less"
+#endif
+#if AXES > 1 && !defined(HOST)
+#error "The cascade runs one axis, two need SAMPLE_MS of 20 or more (sampling.h)"
+#endif
+
+#define CTRL_INPUT 1    /* Position; the velocity is read in ctrl_output() */
+#define CASC_VMAX 250   /* Velocity reference limit */
+
+/**
+ * Formats. The coefficients have those of coeffs.h (CASC_<NAME>_Q) and
+ * the inputs keep the ADC_FRAC_BITS of readInputQ(). The velocities
+ * and the integral carry 5 fractional bits. The outer loop and the
+ * integral update are accumulated with 18 fractional bits, the Q13
+ * gains times the states, and the inner output with 15, K times a
+ * state, each rounded once.
+ */
+typedef Q_TYPE(ADC_FRAC_BITS) input_t;
+typedef q5_t state_t;
+typedef acc18_t acc_t;
+typedef acc15_t out_acc_t;
+
+/* Coefficients in RAM, updated over the serial line (see params.h) */
+enum { P_K, P_H_TI, P_K1, P_K2, P_KR, P_COUNT };
+#define PARAM_COUNT P_COUNT
+#include "params.h"
+
+static const int16_t param_values[P_COUNT] PROGMEM = {
+  CASC_K_FX, CASC_H_TI_FX, CASC_K1_FX, CASC_K2_FX, CASC_KR_FX
+};
+#define PARAM_MAGIC (0x6366 ^ SAMPLE_MS)   /* "cf" */
+
+#define K      ((Q_TYPE(CASC_K_Q)) { P[P_K] })
+#define H_Ti   ((Q_TYPE(CASC_H_TI_Q)) { P[P_H_TI] })
+#define k1     ((Q_TYPE(CASC_K1_Q)) { P[P_K1] })
+#define k2     ((Q_TYPE(CASC_K2_Q)) { P[P_K2] })
+#define kr     ((Q_TYPE(CASC_KR_Q)) { P[P_KR] })
+
+/* Saturation count sites (-DSATCOUNT, see satcount.h) */
+enum { SAT_VREF, SAT_U, SAT_I };
+#define SAT_NAMES "vref u I"
+
+#include "controller.h"
+
+state_t I[AXES];            /* Inner integral */
+static state_t vref[AXES];  /* Velocity reference from the outer loop */
+static state_t vel[AXES];   /* Measured velocity */
+static uint8_t casc_ctr[AXES];
+
+#define VREF_MAX FIXED_CONST(CASC_VMAX, 5)
+
+static void ctrl_init(void) {
+  param_init(param_values, PARAM_MAGIC);
+}
+
+static inline int16_t ctrl_output(uint8_t a, int16_t yq, int16_t r) {
+  const int16_t *P = param_active;
+  input_t Y = {yq};
+  acc_t acc = {0};
+  out_acc_t out = {0};
+  int16_t u;
+
+  vel[a] = q_conv(state_t, ((input_t) { readInputQ(AXIS_INPUT(a, 0)) }));
+  if (casc_ctr[a] == 0) {
+    SAT_SITE(SAT_VREF);
+    acc = q_mac(acc, kr, ((q0_t) { r }));
+    acc = q_msc(acc, k1, vel[a]);
+    acc = q_msc(acc, k2, Y);
+    vref[a] = q_conv(state_t, acc);
+    if (vref[a].raw > VREF_MAX) vref[a].raw = VREF_MAX;
+    else if (vref[a].raw < -VREF_MAX) vref[a].raw = -VREF_MAX;
+  }
+  if (++casc_ctr[a] == CASC_DIV) casc_ctr[a] = 0;
+
+  SAT_SITE(SAT_U);
+  out = q_mac(out, K, q_sub(vref[a], vel[a]));
+  u = q_conv(q0_t, q_acc_add(out, I[a])).raw;
+  if(u > 511) { u = 511; SAT_LIMIT(); }
+  else if(u< -512) { u = -512; SAT_LIMIT(); }
+  return u;
+}
+
+/**
+ * Inner integral with back-calculation anti-windup (see mode.h)
+ */
+static inline void ctrl_update(uint8_t a, int16_t yq, int16_t r, int16_t u) {
+  const int16_t *P = param_active;
+  acc_t acc = {0};
+
+  SAT_SITE(SAT_I);
+  acc = q_mac(acc, H_Ti, q_sub(q_conv(state_t, ((q0_t) { u })), I[a]));
+  I[a] = q_add(I[a], q_conv(state_t, acc));
+}
+
+/**
+ * Inner output 0 if vref were the velocity, i.e. I = 0 without
+ * set-point weighting. The outer loop runs on the first sample after
+ * switching on.
+ */
+static inline void ctrl_track(uint8_t a, int16_t yq, int16_t r) {
+  vel[a] = q_conv(state_t, ((input_t) { readInputQ(AXIS_INPUT(a, 0)) }));
+  I[a] = vref[a] = (state_t) {0};
+  casc_ctr[a] = 0;
+}
+
+static inline void ctrl_reset(uint8_t a) {
+  I[a] = vref[a] = vel[a] = (state_t) {0};
+  casc_ctr[a] = 0;
+}
+
+static inline void ctrl_snapshot(uint8_t a, int16_t yq, int16_t r, int16_t u) {
+  telemetry_sample(roundInput(yq), r, u, q_conv(q0_t, vel[a]).raw,
+                   q_conv(q0_t, vref[a]).raw, q_conv(q0_t, I[a]).raw, 0);
+}
+
+static inline void ctrl_states(uint8_t a, double s[4]) {
+  s[0] = q_float(vel[a]);
+  s[1] = q_float(vref[a]);
+  s[2] = q_float(I[a]);
+  s[3] = 0;
+}
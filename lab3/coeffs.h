@@ -0,0 +1,242 @@
+/**
+ * Controller coefficients for the sample period selected in sampling.h.
+ *
+ * Generated by host/coeffgen.c, do not edit. To change the design or
+ * add a sample period, edit and rerun the generator:
+ *   ./coeffgen 50 20 10 5 2 > coeffs.h
+ *
+ * Position controller: the model in host/plant.h sampled with
+ * zero-order hold (phi, gamma), state feedback K = [k1 k2] and kr, and
+ * observer gains L = [l1 l2 lv] for the model augmented with an input
+ * disturbance v. Every period has the poles of the 50 ms lab design,
+ * 0.8 +- 0.1i and observer 0.6 +- 0.2i, 0.55, mapped by z = exp(s h).
+ * phi12 = 0 and phi22 = 1 for every period.
+ *
+ * Velocity controller: PI with PI_K, PI_TI and PI_B, and back-calculation
+ * anti-windup with tracking time constant PI_TR.
+ *
+ * Cascade controller: inner velocity PI with CASC_K and CASC_TI, poles at
+ * 25 rad/s, damping 0.7. Its set-point weight is b = 1, since the
+ * velocity reference comes from the outer loop, which already shapes
+ * it, and a smaller b would slow the inner response that the outer
+ * design assumes. Its anti-windup tracking time constant is Tr = Ti,
+ * the form that keeps the integral within the output range (see
+ * cascfixed.c). Outer loop: state feedback CASC_K1, CASC_K2 and
+ * CASC_KR on the measured velocity and position, as in the position
+ * controller, with poles at 14 rad/s, damping 0.8, at the outer period
+ * CASC_DIV h.
+ *
+ * For posfixed.c and velfixed.c, <NAME>_Q is the number of fractional
+ * bits of each coefficient, chosen per period so that the value uses
+ * at most half the int16_t range, and <NAME>_FX the coefficient in
+ * that format. For cascfixed.c the formats are the same for every
+ * period: 10 fractional bits for the cascade gain K above 4, 13 for
+ * the rest. The values are computed and range-checked by the
+ * compiler, see FIXED_CONST() in fixedpoint.h.
+ */
+
+#ifndef COEFFS_H
+#define COEFFS_H
+
+#include "sampling.h"
+#include "fixedpoint.h"
+
+#if SAMPLE_MS == 50
+#define PHI11      0.994017964
+#define PHI21      0.249251498
+#define GAMMA1     0.112163174
+#define GAMMA2     0.014034417
+#define K1         3.289787111
+#define K2         1.783116444
+#define KR         1.783116444
+#define L1         2.036149208
+#define L2         1.244017964
+#define LV         3.209609600
+#define PHI11_Q    14
+#define PHI21_Q    16
+#define GAMMA1_Q   17
+#define GAMMA2_Q   20
+#define K1_Q       12
+#define K2_Q       13
+#define KR_Q       13
+#define L1_Q       12
+#define L2_Q       13
+#define LV_Q       12
+#define KH_TI_Q    15
+#define H_TR_Q     16
+#define CASC_K1    0.166910274
+#define CASC_K2    0.853725927
+#define CASC_KR    0.853725927
+
+#elif SAMPLE_MS == 20
+#define PHI11      0.997602878
+#define PHI21      0.099880096
+#define GAMMA1     0.044946043
+#define GAMMA2     0.002248201
+#define K1         3.569335454
+#define K2         2.021080836
+#define KR         2.021080836
+#define L1         1.103118787
+#define L2         0.558958894
+#define LV         1.978491690
+#define PHI11_Q    14
+#define PHI21_Q    17
+#define GAMMA1_Q   18
+#define GAMMA2_Q   22
+#define K1_Q       12
+#define K2_Q       12
+#define KR_Q       12
+#define L1_Q       13
+#define L2_Q       14
+#define LV_Q       13
+#define KH_TI_Q    17
+#define H_TR_Q     17
+#define CASC_K1    0.200444154
+#define CASC_K2    1.461789460
+#define CASC_KR    1.461789460
+
+#elif SAMPLE_MS == 10
+#define PHI11      0.998800720
+#define PHI21      0.049970012
+#define GAMMA1     0.022486505
+#define GAMMA2     0.000562275
+#define K1         3.670425034
+#define K2         2.108130598
+#define KR         2.108130598
+#define L1         0.612570760
+#define L2         0.290386513
+#define LV         1.146999699
+#define PHI11_Q    14
+#define PHI21_Q    18
+#define GAMMA1_Q   19
+#define GAMMA2_Q   24
+#define K1_Q       12
+#define K2_Q       12
+#define KR_Q       12
+#define L1_Q       14
+#define L2_Q       15
+#define LV_Q       13
+#define KH_TI_Q    18
+#define H_TR_Q     18
+#define CASC_K1    0.102377671
+#define CASC_K2    1.587399247
+#define CASC_KR    1.587399247
+
+#elif SAMPLE_MS == 5
+#define PHI11      0.999400180
+#define PHI21      0.024992501
+#define GAMMA1     0.011246626
+#define GAMMA2     0.000140597
+#define K1         3.722579534
+#define K2         2.153217958
+#define KR         2.153217958
+#define L1         0.323028018
+#define L2         0.147982503
+#define LV         0.617977098
+#define PHI11_Q    14
+#define PHI21_Q    19
+#define GAMMA1_Q   20
+#define GAMMA2_Q   26
+#define K1_Q       12
+#define K2_Q       12
+#define KR_Q       12
+#define L1_Q       15
+#define L2_Q       16
+#define LV_Q       14
+#define KH_TI_Q    19
+#define H_TR_Q     19
+#define CASC_K1    0.012205407
+#define CASC_K2    1.598306516
+#define CASC_KR    1.598306516
+
+#elif SAMPLE_MS == 2
+#define PHI11      0.999760029
+#define PHI21      0.009998800
+#define GAMMA1     0.004499460
+#define GAMMA2     0.000022498
+#define K1         3.754404979
+#define K2         2.180785858
+#define KR         2.180785858
+#define L1         0.133437583
+#define L2         0.059870311
+#define LV         0.258579956
+#define PHI11_Q    14
+#define PHI21_Q    20
+#define GAMMA1_Q   21
+#define GAMMA2_Q   29
+#define K1_Q       12
+#define K2_Q       12
+#define KR_Q       12
+#define L1_Q       16
+#define L2_Q       18
+#define LV_Q       15
+#define KH_TI_Q    20
+#define H_TR_Q     20
+#define CASC_K1    -0.054763137
+#define CASC_K2    1.585112953
+#define CASC_KR    1.585112953
+
+#else
+#error "No coefficients for this SAMPLE_MS, rerun host/coeffgen.c"
+#endif
+
+#define PI_K       2.613300000
+#define PI_TI      0.452300000
+#define PI_B       0.500000000
+#define PI_TR      0.250000000
+#define KH_TI      (PI_K * SAMPLE_H / PI_TI)
+#define H_TR       (SAMPLE_H / PI_TR)
+#define PI_K_Q     12
+#define PI_KB_Q    13
+
+#define CASC_K     15.502222222
+#define CASC_TI    0.055808000
+#define CASC_H_TI  (SAMPLE_H / CASC_TI)
+#define CASC_DIV   5
+#define CASC_K_Q   10
+#define CASC_H_TI_Q 13
+#define CASC_K1_Q  13
+#define CASC_K2_Q  13
+#define CASC_KR_Q  13
+
+#define PHI11_FX   FIXED_CONST(PHI11, PHI11_Q)
+#define PHI21_FX   FIXED_CONST(PHI21, PHI21_Q)
+#define GAMMA1_FX  FIXED_CONST(GAMMA1, GAMMA1_Q)
+#define GAMMA2_FX  FIXED_CONST(GAMMA2, GAMMA2_Q)
+#define K1_FX      FIXED_CONST(K1, K1_Q)
+#define K2_FX      FIXED_CONST(K2, K2_Q)
+#define KR_FX      FIXED_CONST(KR, KR_Q)
+#define L1_FX      FIXED_CONST(L1, L1_Q)
+#define L2_FX      FIXED_CONST(L2, L2_Q)
+#define LV_FX      FIXED_CONST(LV, LV_Q)
+#define PI_K_FX    FIXED_CONST(PI_K, PI_K_Q)
+#define PI_KB_FX   FIXED_CONST(PI_K * PI_B, PI_KB_Q)
+#define KH_TI_FX   FIXED_CONST(KH_TI, KH_TI_Q)
+#define H_TR_FX    FIXED_CONST(H_TR, H_TR_Q)
+#define CASC_K_FX  FIXED_CONST(CASC_K, CASC_K_Q)
+#define CASC_H_TI_FX FIXED_CONST(CASC_H_TI, CASC_H_TI_Q)
+#define CASC_K1_FX FIXED_CONST(CASC_K1, CASC_K1_Q)
+#define CASC_K2_FX FIXED_CONST(CASC_K2, CASC_K2_Q)
+#define CASC_KR_FX FIXED_CONST(CASC_KR, CASC_KR_Q)
+
+FIXED_CHECK(PHI11, PHI11_Q);
+FIXED_CHECK(PHI21, PHI21_Q);
+FIXED_CHECK(GAMMA1, GAMMA1_Q);
+FIXED_CHECK(GAMMA2, GAMMA2_Q);
+FIXED_CHECK(K1, K1_Q);
+FIXED_CHECK(K2, K2_Q);
+FIXED_CHECK(KR, KR_Q);
+FIXED_CHECK(L1, L1_Q);
+FIXED_CHECK(L2, L2_Q);
+FIXED_CHECK(LV, LV_Q);
+FIXED_CHECK(PI_K, PI_K_Q);
+FIXED_CHECK(PI_K * PI_B, PI_KB_Q);
+FIXED_CHECK(KH_TI, KH_TI_Q);
+FIXED_CHECK(H_TR, H_TR_Q);
+FIXED_CHECK(CASC_K, CASC_K_Q);
+FIXED_CHECK(CASC_H_TI, CASC_H_TI_Q);
+FIXED_CHECK(CASC_K1, CASC_K1_Q);
+FIXED_CHECK(CASC_K2, CASC_K2_Q);
+FIXED_CHECK(CASC_KR, CASC_KR_Q);
+
+#endif
@@ -0,0 +1,296 @@
+/**
+ * Board program shared by the DC-servo controllers.
+ *
+ * This file holds everything that does not depend on the control law:
+ * main() with the port, timer and USART setup and the idle loop, the
+ * serial command interrupt and the control interrupt with its
+ * sampling, reference, mode and telemetry handling. The interrupts do
+ * the work that belongs to a sample or a received byte and post the
+ * rest as background tasks, which main() runs before it sleeps until
+ * the next interrupt (tasks.h). A controller is one .c file that
+ * defines CTRL_INPUT, includes this file and implements
+ *
+ *   static void ctrl_init(void);
+ *       before interrupts are enabled, e.g. param_init()
+ *   static inline int16_t ctrl_output(uint8_t a, int16_t yq, int16_t r);
+ *       MODE_ON: the output for this sample, limited to [-512..511]
+ *   static inline void ctrl_update(uint8_t a, int16_t yq, int16_t r, int16_t u);
+ *       MODE_ON: update the states with the output u that was applied
+ *   static inline void ctrl_track(uint8_t a, int16_t yq, int16_t r);
+ *       MODE_TRACK: let the states follow the plant, the output is 0
+ *   static inline void ctrl_reset(uint8_t a);
+ *       MODE_OFF: clear the states
+ *   static inline void ctrl_snapshot(uint8_t a, int16_t yq, int16_t r, int16_t u);
+ *       record the sample with telemetry_sample()
+ *   static inline void ctrl_states(uint8_t a, double s[4]);
+ *       the telemetry states in input units, unused states 0, for the
+ *       host tools (host/servosim.c -s); double, so that 32-bit states
+ *       are exact; not called on the AVR
+ *
+ * a is the axis, 0 to AXES - 1 (hal.h). A controller keeps its states
+ * as arrays indexed by the axis, one element per servo, and shares the
+ * coefficients between the axes.
+ *
+ * yq is input CTRL_INPUT (0 velocity, 1 position) of the axis with
+ * ADC_FRAC_BITS fractional bits; roundInput() gives the integer value.
+ * The output is written between ctrl_output() and ctrl_update(), so the
+ * work after it does not delay the output. The interface is resolved
+ * at compile time: the controller and this file form one translation
+ * unit, the ctrl_ functions are static and inlined into the interrupt
+ * handler, and the dispatch costs nothing over writing the law into
+ * the handler directly. A controller with parameters in RAM (params.h)
+ * includes params.h before this file; the commit and save handling is
+ * then added here. Its coefficients are loaded from RAM instead of
+ * being constants in the code, a few cycles per coefficient (see
+ * params.h). Saturation counts (satcount.h) are reported if the
+ * controller defines SAT_NAMES before including this file.
+ *
+ * User communication via the serial line. Commands:
+ *   s: start controller
+ *   t: stop controller, keep tracking the plant (see mode.h)
+ *   f: stop controller and clear its state
+ *   i: stop controller, excite the plant for identification and start
+ *      the telemetry (see ident.h)
+ *   r: change sign of reference (+/- 5.0 volt)
+ *   0, 1: select the axis the commands above, the reference frames and
+ *      the telemetry apply to (built with -DAXES=2)
+ *   (binary frames set the reference or play profiles, see reference.h,
+ *   and update the coefficients, see params.h)
+ *   b: start/stop binary telemetry stream (see telemetry.h)
+ *   u: print serial transmit queue statistics
+ *   p: print ISR execution-time profile (built with -DPROFILE)
+ *   o: print fixed-point saturation counts (built with -DSATCOUNT)
+ *   l: arm the logger, or trigger it if armed (built with -DLOGGER,
+ *      see logger.h)
+ *
+ * To compile for the ATmega8 AVR, e.g. the position controller:
+ *   avr-gcc -mmcu=atmega8 -O -g -Wall -o DCservo.elf posfixed.c
+ *
+ * To upload to the ATmega8 AVR:
+ *   avr-objcopy -Osrec DCservo.elf DCservo.sr
+ *   avrdude -e -p atmega8 -P /dev/ttyACM0 -c avrisp2 -U flash:w:DCservo.sr:a
+ *
+ * To compile for the ATmega16 AVR:
+ *   avr-gcc -mmcu=atmega16 -O -g -Wall -o DCservo.elf posfixed.c
+ *
+ * To upload to the ATmega16 AVR:
+ *   avr-objcopy -Osrec DCservo.elf DCservo.sr
+ *   avrdude -e -p atmega16 -P usb -c avrisp2 -U flash:w:DCservo.sr:a
+ *
+ * To view the assembler code:
+ *   avr-objdump -S DCservo.elf
+ *
+ * To open a serial terminal on the PC:
+ *   simcom -38400 /dev/ttyS0
+ */
+
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <inttypes.h>
+#include "hal.h"
+#include "profiler.h"
+#include "telemetry.h"
+#include "reference.h"
+#include "mode.h"
+#include "ident.h"
+#include "satcount.h"
+#include "sampling.h"
+#include "tasks.h"
+
+#ifndef CTRL_INPUT
+#error "Define CTRL_INPUT (0 velocity, 1 position) before including controller.h"
+#endif
+
+#if AXES > SAMPLE_DIV && !defined(HOST)
+#error "Each axis needs its own timer tick, use a longer SAMPLE_MS"
+#endif
+
+static void ctrl_init(void);
+static inline int16_t ctrl_output(uint8_t a, int16_t yq, int16_t r);
+static inline void ctrl_update(uint8_t a, int16_t yq, int16_t r, int16_t u);
+static inline void ctrl_track(uint8_t a, int16_t yq, int16_t r);
+static inline void ctrl_reset(uint8_t a);
+static inline void ctrl_snapshot(uint8_t a, int16_t yq, int16_t r, int16_t u);
+static inline void ctrl_states(uint8_t a, double s[4]);
+
+/* MODE_OFF, MODE_TRACK, MODE_ON or MODE_IDENT per axis, see mode.h */
+uint8_t mode[AXES] = { [0 ... AXES - 1] = MODE_TRACK };
+/* Reference per axis, 255 corresponds to +5.0 V */
+int16_t r[AXES] = { [0 ... AXES - 1] = 255 };
+uint8_t axis = 0;                  /* Axis selected for commands and telemetry */
+
+#define AXIS_SELECTED(a) (AXES == 1 || (a) == axis)
+
+/**
+ * Interrupt handler for receiving characters over serial connection
+ * Interrupt occurs when data has been received
+ */
+ISR(USART_RXC_vect){
+  uint8_t ch = UDR;                /* USART I/O Data Register */
+  if (ref_rx(ch)) return;          /* Binary reference frame, see reference.h */
+  switch (ch) {
+  case 's':                        /* Start the controller */
+    put_char('s');
+    mode[axis] = MODE_ON;
+    break;
+  case 't':                        /* Stop the controller, track the plant */
+    put_char('t');
+    mode[axis] = MODE_TRACK;
+    break;
+  case 'f':                        /* Stop the controller, clear its state */
+    put_char('f');
+    mode[axis] = MODE_OFF;
+    break;
+  case 'i':                        /* Identification, see ident.h */
+    put_char('i');
+    ident_start();
+    mode[axis] = MODE_IDENT;
+    break;
+  case 'r':                        /* Change sign of reference */
+    put_char('r');
+    r[axis] = -r[axis];
+    break;
+#if AXES > 1
+  case '0':                        /* Select an axis */
+  case '1':
+    put_char(ch);
+    axis = ch - '0';
+    break;
+#endif
+  case 'b':                        /* Start/stop binary telemetry */
+    put_char('b');
+    telemetry_toggle();
+    break;
+  case 'u':                        /* Print serial queue statistics */
+    put_char('u');
+    task_post(TASK_UART);
+    break;
+#ifdef PROFILE
+  case 'p':                        /* Print ISR execution-time profile */
+    put_char('p');
+    PROF_REQUEST();
+    break;
+#endif
+#if defined(SATCOUNT) && defined(SAT_NAMES)
+  case 'o':                        /* Print fixed-point saturation counts */
+    put_char('o');
+    SAT_REQUEST();
+    break;
+#endif
+#ifdef LOGGER
+  case 'l':                        /* Arm or trigger the logger */
+    put_char('l');
+    LOG_COMMAND();
+    break;
+#endif
+  }
+}
+
+/**
+ * Interrupt handler for the periodic timer. Interrupts are generated
+ * every SAMPLE_TICK s and the control algorithm of each axis is
+ * executed every SAMPLE_DIV ticks (every 50 ms by default, see
+ * sampling.h). The axes are staggered, axis a running a ticks after
+ * axis 0, so one interrupt never does more than one axis and the
+ * longest interrupt stays that of a single-axis build.
+ */
+ISR(TIMER2_COMP_vect){
+  static uint8_t tick = 0;
+  uint8_t a;
+  int16_t yq, u;
+  REF_TICK();          /* Partial frame timeout, see reference.h */
+  if (++tick == SAMPLE_DIV) tick = 0;
+  if (tick >= AXES) return;
+  a = AXES == 1 ? 0 : tick;        /* a constant with one axis */
+  PROF_START();
+  yq = readInputQ(AXIS_INPUT(a, CTRL_INPUT));
+  PROF_MARK(PROF_READ);
+  if (AXIS_SELECTED(a))
+    REF_UPDATE(r[a]);  /* Pending set or profile point, see reference.h */
+#ifdef PARAMS_H
+  if (a == 0)
+    PARAM_UPDATE();    /* Committed coefficients, see params.h */
+#endif
+  if (mode[a] == MODE_ON) u = ctrl_output(a, yq, r[a]);
+  else if (mode[a] == MODE_IDENT) u = ident_output(a);
+  else u = 0;
+  PROF_MARK(PROF_COMPUTE);
+  writeOutput(a, u);
+
+  if (mode[a] == MODE_ON) ctrl_update(a, yq, r[a], u);
+  else if (mode[a] == MODE_TRACK) ctrl_track(a, yq, r[a]);
+  else ctrl_reset(a);
+  if (AXIS_SELECTED(a)) {
+    if (mode[a] == MODE_IDENT) ident_snapshot(u);
+    else ctrl_snapshot(a, yq, r[a], u);
+  }
+  PROF_MARK(PROF_WRITE);
+  PROF_END();
+}
+
+/**
+ * Run the background tasks in tasks. Called from main() with the tasks
+ * posted since the last call, and from host/servosim.c after a tick.
+ */
+static void ctrl_background(uint8_t tasks) {
+  if (tasks & TASK_TELEMETRY) telemetry_send();
+  if (tasks & TASK_UART) uart_report(uart_put_wait);
+  PROF_POLL(tasks, uart_put_wait);
+#if defined(SATCOUNT) && defined(SAT_NAMES)
+  SAT_POLL(tasks, uart_put_wait);
+#endif
+#ifdef PARAMS_H
+  PARAM_POLL(tasks);
+#endif
+  LOG_POLL(tasks, uart_write_wait);
+}
+
+/**
+ * Main program
+ */
+int main(){
+
+  /* Set port data directions and configure ADC */
+#if AXES > 1
+  DDRB = 0x06;    /* Enable PWM outputs OC1A & OC1B for ATmega8 */
+  DDRD = 0x30;    /* Enable PWM outputs OC1A & OC1B for ATmega16 */
+#else
+  DDRB = 0x02;    /* Enable PWM output for ATmega8 */
+  DDRD = 0x20;    /* Enable PWM output for ATmega16 */
+#endif
+  DDRC = 0x30;    /* Enable time measurement pins */
+  adc_init();     /* Background AD conversion, see adc.h */
+
+  /* Timer/Counter configuration */
+  TCCR1A = 0xf3;  /* Timer 1: OC1A & OC1B 10 bit fast PWM */
+  TCCR1B = 0x09;  /* Clock / 1 (i.e. no prescaling) */
+
+  TCNT2 = 0x00;   /* Timer 2: Reset counter (periodic timer) */
+  TCCR2 = 0x0f;   /* Clock / 1024, clear after compare match (CTC) */
+  OCR2 = SAMPLE_OCR2; /* Set the output compare register, ~100 Hz by default */
+
+  /* Configure serial communication */
+  /* Set USART Control and Status Registers */
+  UCSRA = 0x00;   /* USART: */
+  UCSRB = 0x98;   /* USART: RXC enable, Receiver enable, Transmitter enable */
+  UCSRC = 0x86;   /* USART: 8bit, no parity, asynchronous */
+  /* 12bit USART baud rate register (high and low byte) */
+  UBRRH = 0x00;   /* USART: 38400 @ 14.7456MHz */
+  UBRRL = 23;     /* USART: 38400 @ 14.7456MHz */
+
+  TIMSK = 1<<OCIE2; /* Start periodic timer */
+
+  ctrl_init();     /* Controller set-up, e.g. coefficients */
+  PROF_INIT();     /* Start the ISR profiler (-DPROFILE) */
+  task_init();     /* Idle sleep between interrupts, see tasks.h */
+
+  sei();          /* Enable interrupts */
+
+  while (1) {
+    ctrl_background(task_take());
+    task_idle();
+  }
+}
+
+#endif
@@ -0,0 +1,261 @@
+/**
+ * Saturating fixed-point arithmetic shared by the DC-servo controllers.
+ *
+ * All signals are int16_t. A constant in Qn format represents k / 2^n,
+ * so mul_n(k, x) returns k*x in the same units as x. Results that do
+ * not fit in 16 bits are clamped to INT16_MAX / INT16_MIN.
+ *
+ * FIXED_DEFINE_Q(n) instantiates the named kernels for one Q shift:
+ *   add_n, sub_n    16-bit saturating add/subtract
+ *   mul_n           16x16->32 multiply, round, shift and saturate
+ *   div_n           (x << n) / y, saturating, 0 on division by zero
+ *   mac_n, msc_n    acc + k*x / acc - k*x on a 32-bit accumulator
+ *   acc_add_n,
+ *   acc_sub_n       acc +/- x for a term that is not multiplied
+ *   round_n         round, shift and saturate an accumulator once
+ *
+ * The mac path is meant for a whole observer row: the products are
+ * summed at full 32-bit precision and rounded and clamped once at the
+ * end, instead of after every term. On the AVR the kernels only use
+ * the 16x16->32 multiply helper, never a 32x32 one.
+ *
+ * For int16_t operands add_n, sub_n, mul_n and div_n give bit-exact
+ * the same results as the int32_t versions they replace; host/fixtest.c
+ * checks this for every pair of operands, and the accumulator kernels,
+ * the typed operations and their clamps against the same sums in 64
+ * bits. host/fixtest.sh runs it and checks that mixing formats does
+ * not compile.
+ *
+ * FIXED_CONST(x, n) converts a real constant to Qn, rounded to
+ * nearest, in a constant expression, so coefficients can be written
+ * as the float design values and cost nothing at run time.
+ * FIXED_CHECK(x, n) stops the build if x does not fit in int16_t as Qn.
+ *
+ * Every clamp is reported to SAT_EVENT(). A controller that includes
+ * satcount.h before this file counts it per call site in a -DSATCOUNT
+ * build; otherwise it is empty, and the library needs nothing but
+ * <inttypes.h>.
+ *
+ * Typed formats. For code that mixes formats, each value can carry
+ * its format in its type: qN_t is an int16_t with N fractional bits
+ * and accN_t a 32-bit accumulator with N fractional bits, N = 0..30,
+ * both structs with a single member raw. Values of different formats
+ * cannot be assigned to each other or added by mistake; the compiler
+ * rejects it. The operations take the formats from the operand types
+ * (FIXED_FRAC()) and do the alignment shifts, all resolved at compile
+ * time, so they cost what the hand-shifted int16_t code costs:
+ *   q_add(a, b), q_sub(a, b)   same format, saturating
+ *   q_mac(acc, k, x),
+ *   q_msc(acc, k, x)           acc +/- k*x, the product aligned to the
+ *                              format of acc, rounded to nearest if
+ *                              that drops bits
+ *   q_acc_add(acc, x),
+ *   q_acc_sub(acc, x)          acc +/- x, aligned
+ *   q_conv(type, x)            x (a value or an accumulator) in format
+ *                              type, rounded to nearest and saturated
+ *   q_mul(type, k, x)          k*x in format type, rounded once
+ *   q_float(x)                 the real value as a double, for host tools
+ * A whole row is accumulated at 32 bits in one format and rounded
+ * once with q_conv(); a product with more fractional bits than the
+ * accumulator is rounded to it on the way in, so give the accumulator
+ * at least as many where the last bit matters. The subtracting forms
+ * negate the term before it is aligned, so that it rounds the same way
+ * as the added one would. Q_TYPE(n) and ACC_TYPE(n) name the type for a
+ * format given by a macro, e.g. Q_TYPE(K1_Q) with K1_Q from coeffs.h.
+ */
+
+#ifndef FIXEDPOINT_H
+#define FIXEDPOINT_H
+
+#include <inttypes.h>
+
+#ifndef SAT_EVENT
+#define SAT_EVENT()
+#endif
+
+typedef int32_t fixed_acc_t;
+
+/**
+ * Clamp a 32-bit intermediate to the int16_t range
+ */
+static inline int16_t fixed_sat16(int32_t x) {
+  if (x > INT16_MAX) {
+    SAT_EVENT();
+    return INT16_MAX;
+  }
+  if (x < INT16_MIN) {
+    SAT_EVENT();
+    return INT16_MIN;
+  }
+  return (int16_t) x;
+}
+
+static inline int16_t fixed_add(int16_t x, int16_t y) {
+  int16_t s;
+  if (__builtin_add_overflow(x, y, &s)) {
+    SAT_EVENT();
+    return (x < 0) ? INT16_MIN : INT16_MAX;
+  }
+  return s;
+}
+
+static inline int16_t fixed_sub(int16_t x, int16_t y) {
+  int16_t s;
+  if (__builtin_sub_overflow(x, y, &s)) {
+    SAT_EVENT();
+    return (x < 0) ? INT16_MIN : INT16_MAX;
+  }
+  return s;
+}
+
+/**
+ * Add a product to a 32-bit accumulator, saturating instead of wrapping
+ */
+static inline fixed_acc_t fixed_acc_sat(fixed_acc_t acc, int32_t p) {
+  fixed_acc_t s;
+  if (__builtin_add_overflow(acc, p, &s)) {
+    SAT_EVENT();
+    return (p < 0) ? INT32_MIN : INT32_MAX;
+  }
+  return s;
+}
+
+static inline fixed_acc_t fixed_mac(fixed_acc_t acc, int16_t k, int16_t x) {
+  return fixed_acc_sat(acc, (int32_t) k * x);
+}
+
+static inline fixed_acc_t fixed_msc(fixed_acc_t acc, int16_t k, int16_t x) {
+  return fixed_acc_sat(acc, -((int32_t) k * x));
+}
+
+/**
+ * Shift down by q > 0, rounding to nearest (ties towards +inf). The
+ * rounding bit is added after the shift, so that it cannot overflow an
+ * accumulator that is already at INT32_MAX.
+ */
+static inline fixed_acc_t fixed_shr_round(fixed_acc_t x, uint8_t q) {
+  return (x >> q) + ((x >> (q - 1)) & 1);
+}
+
+/**
+ * Round to nearest (ties towards +inf), shift down by q and saturate
+ */
+static inline int16_t fixed_round(fixed_acc_t acc, uint8_t q) {
+  if (q == 0) return fixed_sat16(acc);
+  return fixed_sat16(fixed_shr_round(acc, q));
+}
+
+static inline int16_t fixed_mul(int16_t k, int16_t x, uint8_t q) {
+  return fixed_round((int32_t) k * x, q);
+}
+
+static inline int16_t fixed_div(int16_t x, int16_t y, uint8_t q) {
+  if (y == 0) return 0;
+  return fixed_sat16((((int32_t) x) << q) / y);
+}
+
+#define FIXED_SCALED(x, n)  ((x) * (double) (1L << (n)))
+#define FIXED_CONST(x, n)   ((int16_t) (FIXED_SCALED(x, n) + (FIXED_SCALED(x, n) < 0 ? -0.5 : 0.5)))
+#define FIXED_FITS(x, n)    (FIXED_SCALED(x, n) > INT16_MIN - 0.5 && \
+                             FIXED_SCALED(x, n) < INT16_MAX + 0.5)
+#define FIXED_CHECK(x, n)   _Static_assert(FIXED_FITS(x, n), #x " does not fit in Q" #n)
+
+/**
+ * Shift a product or accumulator from s more fractional bits than the
+ * target (s < 0: fewer), rounding to nearest like fixed_round() and
+ * saturating. s is a constant, so only one branch is compiled.
+ */
+static inline fixed_acc_t fixed_align(fixed_acc_t x, int8_t s) {
+  if (s > 0) return fixed_shr_round(x, s);
+  if (s < 0) {
+    if (x > (INT32_MAX >> -s)) {
+      SAT_EVENT();
+      return INT32_MAX;
+    }
+    if (x < (INT32_MIN >> -s)) {
+      SAT_EVENT();
+      return INT32_MIN;
+    }
+    return x * ((fixed_acc_t) 1 << -s);
+  }
+  return x;
+}
+
+/**
+ * Round an accumulator with s more fractional bits than the target to
+ * int16_t, saturating; s <= 0 shifts up instead
+ */
+static inline int16_t fixed_to16(fixed_acc_t x, int8_t s) {
+  if (s > 0) return fixed_round(x, s);
+  return fixed_sat16(fixed_align(x, s));
+}
+
+#define FIXED_DEFINE_Q(n)                                                     \
+  static inline int16_t add_##n(int16_t x, int16_t y) {                       \
+    return fixed_add(x, y);                                                   \
+  }                                                                           \
+  static inline int16_t sub_##n(int16_t x, int16_t y) {                       \
+    return fixed_sub(x, y);                                                   \
+  }                                                                           \
+  static inline int16_t mul_##n(int16_t k, int16_t x) {                       \
+    return fixed_mul(k, x, n);                                                \
+  }                                                                           \
+  static inline int16_t div_##n(int16_t x, int16_t y) {                       \
+    return fixed_div(x, y, n);                                                \
+  }                                                                           \
+  static inline fixed_acc_t mac_##n(fixed_acc_t acc, int16_t k, int16_t x) {  \
+    return fixed_mac(acc, k, x);                                              \
+  }                                                                           \
+  static inline fixed_acc_t msc_##n(fixed_acc_t acc, int16_t k, int16_t x) {  \
+    return fixed_msc(acc, k, x);                                              \
+  }                                                                           \
+  static inline fixed_acc_t acc_add_##n(fixed_acc_t acc, int16_t x) {         \
+    return fixed_acc_sat(acc, ((int32_t) x) << n);                            \
+  }                                                                           \
+  static inline fixed_acc_t acc_sub_##n(fixed_acc_t acc, int16_t x) {         \
+    return fixed_acc_sat(acc, -(((int32_t) x) << n));                         \
+  }                                                                           \
+  static inline int16_t round_##n(fixed_acc_t acc) {                          \
+    return fixed_round(acc, n);                                               \
+  }
+
+#define FIXED_FORMATS(X)                                                      \
+  X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10) X(11) X(12) X(13)   \
+  X(14) X(15) X(16) X(17) X(18) X(19) X(20) X(21) X(22) X(23) X(24) X(25)     \
+  X(26) X(27) X(28) X(29) X(30)
+
+#define FIXED_TYPEDEF(n)                                                      \
+  typedef struct { int16_t raw; } q##n##_t;                                   \
+  typedef struct { fixed_acc_t raw; } acc##n##_t;
+FIXED_FORMATS(FIXED_TYPEDEF)
+typedef struct { char none; } fixed_no_format_t;   /* ends the FIXED_FRAC() list */
+
+#define Q_TYPE(n)            Q_TYPE_(n)
+#define Q_TYPE_(n)           q##n##_t
+#define ACC_TYPE(n)          ACC_TYPE_(n)
+#define ACC_TYPE_(n)         acc##n##_t
+
+#define FIXED_FRAC_CASE(n)   q##n##_t: n, acc##n##_t: n,
+#define FIXED_FRAC(x)        _Generic((x), FIXED_FORMATS(FIXED_FRAC_CASE)          \
+                                      fixed_no_format_t: -1)
+#define FIXED_SAME(a, b)     _Generic((b), __typeof__(a): (b))
+
+#define q_add(a, b)          ((__typeof__(a)) { fixed_add((a).raw, FIXED_SAME(a, b).raw) })
+#define q_sub(a, b)          ((__typeof__(a)) { fixed_sub((a).raw, FIXED_SAME(a, b).raw) })
+#define q_mac(acc, k, x)     ((__typeof__(acc)) { fixed_acc_sat((acc).raw,                 \
+                                 fixed_align((int32_t) (k).raw * (x).raw,                 \
+                                   FIXED_FRAC(k) + FIXED_FRAC(x) - FIXED_FRAC(acc))) })
+#define q_msc(acc, k, x)     ((__typeof__(acc)) { fixed_acc_sat((acc).raw,                 \
+                                 fixed_align(-((int32_t) (k).raw * (x).raw),              \
+                                   FIXED_FRAC(k) + FIXED_FRAC(x) - FIXED_FRAC(acc))) })
+#define q_acc_add(acc, x)    ((__typeof__(acc)) { fixed_acc_sat((acc).raw,                 \
+                                 fixed_align((x).raw, FIXED_FRAC(x) - FIXED_FRAC(acc))) })
+#define q_acc_sub(acc, x)    ((__typeof__(acc)) { fixed_acc_sat((acc).raw,                 \
+                                 fixed_align(-(int32_t) (x).raw,                          \
+                                   FIXED_FRAC(x) - FIXED_FRAC(acc))) })
+#define q_conv(type, x)      ((type) { fixed_to16((x).raw, FIXED_FRAC(x) - FIXED_FRAC((type) {0})) })
+#define q_mul(type, k, x)    ((type) { fixed_to16((int32_t) (k).raw * (x).raw,              \
+                                 FIXED_FRAC(k) + FIXED_FRAC(x) - FIXED_FRAC((type) {0})) })
+#define q_float(x)           ((x).raw * (1.0 / (1L << FIXED_FRAC(x))))
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * Hardware access layer for the DC-servo controllers.
+ *
+ * By default this is the board code from the lab skeleton: PWM output
+ * on the ATmega8/ATmega16. AD input comes from the background
+ * conversions in adc.h and serial output goes through the
+ * interrupt-driven transmit queue in uart.h.
+ *
+ * Built with -DHOST the controllers compile natively instead. The AVR
+ * registers that main() configures become plain variables, ISR(vector)
+ * becomes an ordinary function that the host program calls, and the
+ * I/O functions forward to sim_read_input() and sim_write_output(),
+ * which the host program provides (host/servosim.c). sim_read_input()
+ * returns the input with ADC_FRAC_BITS fractional bits, like adc.h.
+ * The host program drains the transmit queue by calling
+ * ISR(USART_UDRE_vect). The firmware's main() is renamed servo_main()
+ * so that the host program can supply its own.
+ *
+ * Up to two servos can be driven from one board, AXES of them (build
+ * with -DAXES=2). Axis a reads its velocity on AD channel 2a and its
+ * position on 2a + 1 (AXIS_INPUT) and writes its output with the PWM
+ * on OC1A for axis 0 and OC1B for axis 1, the two outputs of Timer1.
+ * A host build may have more axes, as independent control loops for
+ * the host tools (host/gainsweep.c).
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <inttypes.h>
+
+#ifndef AXES
+#define AXES 1
+#endif
+#if AXES < 1 || (AXES > 2 && !defined(HOST))
+#error "AXES must be 1 or 2, Timer1 has two PWM outputs"
+#endif
+
+/* AD channel of input chan (0 velocity, 1 position) of axis a */
+#define AXIS_INPUT(a, chan) (2 * (a) + (chan))
+
+#ifdef HOST
+
+#define ISR(vector) void vector(void)
+#define sei()
+#define cli()
+#define main servo_main
+
+static volatile uint8_t DDRB, DDRC, DDRD, PORTC;
+static volatile uint8_t ADCSRA, ADMUX;
+static volatile uint16_t ADC;
+static volatile uint8_t TCCR1A, TCCR1B, TCCR2, TCNT2, OCR2, TIMSK;
+static volatile uint8_t UCSRA, UCSRB, UCSRC, UBRRH, UBRRL, UDR;
+
+#define OCIE2 7
+
+int16_t sim_read_input(uint8_t chan);
+void sim_write_output(uint8_t axis, int16_t val);
+
+static inline void writeOutput(uint8_t axis, int16_t val) {
+  sim_write_output(axis, val);
+}
+
+#else
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/**
+ * Write 10-bit output of an axis using the PWM generator
+ */
+static inline void writeOutput(uint8_t axis, int16_t val) {
+  val += 512;
+  if (axis == 0) {
+    OCR1AH = (uint8_t) (val>>8);
+    OCR1AL = (uint8_t) val;
+  } else {
+    OCR1BH = (uint8_t) (val>>8);
+    OCR1BL = (uint8_t) val;
+  }
+}
+
+#endif
+
+#include "adc.h"
+#include "uart.h"
+
+/**
+ * Read input from AD channel (0 to 2 * AXES - 1): the latest decimated
+ * value, [-512..511] with ADC_FRAC_BITS fractional bits. Never waits.
+ */
+static inline int16_t readInputQ(uint8_t chan) {
+#ifdef HOST
+  return sim_read_input(chan);
+#else
+  return adc_latest(chan);
+#endif
+}
+
+/**
+ * Round an input with ADC_FRAC_BITS fractional bits to [-512..511]
+ */
+static inline int16_t roundInput(int16_t q) {
+  return (q + (1 << (ADC_FRAC_BITS - 1))) >> ADC_FRAC_BITS;
+}
+
+/**
+ * Read 10-bit input from AD channel, rounded to [-512..511]
+ */
+static inline int16_t readInput(uint8_t chan) {
+  return roundInput(readInputQ(chan));
+}
+
+/**
+ * Write a character on the serial connection. Never waits; the
+ * character is dropped if the transmit queue is full.
+ */
+static inline void put_char(char ch) {
+  uart_put(ch);
+}
+
+#endif
@@ -0,0 +1,246 @@
+/**
+ * Generator for coeffs.h, the controller coefficients.
+ *
+ * Starts from the physical design: the continuous DC-servo model in
+ * plant.h, the pole locations of the lab design and the PI parameters.
+ * For each requested sample period it samples the model with
+ * zero-order hold, places the state-feedback and observer poles with
+ * Ackermann's formula and scales kr for unit static gain, and prints
+ * the result as a C header. The fixed-point versions of the
+ * coefficients are not computed here: coeffs.h derives them with
+ * FIXED_CONST() and range-checks them with FIXED_CHECK() (fixedpoint.h)
+ * when the controller is compiled. What is chosen here is the format
+ * of each coefficient of posfixed.c and velfixed.c, per period: the
+ * most fractional bits that keep the value within half the int16_t
+ * range, so that it can still be retuned over the serial line to
+ * twice its design value (see coeff_format()). Compiled with another
+ * COEFF_HEADROOM, it leaves that many bits free instead of one, as
+ * host/formatsweep.sh does to try other formats.
+ *
+ * The cascade controller (cascfixed.c) has an inner velocity PI placed
+ * at CASC_WI, CASC_ZI on the velocity model b/(s + a), without set-point
+ * weighting and with anti-windup tracking time constant Tr = Ti; these
+ * are continuous-time gains, discretized by the controller with
+ * SAMPLE_H. Its outer loop is the state feedback of the position
+ * controller on the measured velocity and position (casc_outer()),
+ * placed at CASC_WO, CASC_ZO for every period at the outer period
+ * CASC_DIV h.
+ *
+ * The poles are given at the 50 ms lab design (closed loop
+ * 0.8 +- 0.1i, observer 0.6 +- 0.2i and 0.55) and mapped to the other
+ * periods through z = exp(s h), so every period has the same
+ * continuous-time dynamics.
+ *
+ * The poles and the PI parameters are in host/design.h. They can be
+ * replaced by those found by host/gainsweep.c, and the model by the
+ * one fitted by host/sysid.c, with gcc -include.
+ *
+ * To regenerate, from the lab3 directory:
+ *   gcc -O2 -Wall -I. -o coeffgen host/coeffgen.c -lm
+ *   ./coeffgen 50 20 10 5 2 > coeffs.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <complex.h>
+#include "plant.h"
+#include "design.h"
+
+#define CASC_WI    25.0              /* Cascade inner velocity loop, rad/s */
+#define CASC_ZI    0.7               /* and its relative damping */
+#define CASC_WO    14.0              /* Cascade outer position poles, rad/s */
+#define CASC_ZO    0.8               /* and its relative damping */
+#define CASC_DIV   5                 /* Inner samples per outer sample */
+
+static void coeff_print(const char *name, double x) {
+  printf("#define %-10s %.9f\n", name, x);
+}
+
+static void coeff_print_format(const char *name, double x) {
+  char q[16];
+  snprintf(q, sizeof q, "%s_Q", name);
+  printf("#define %-10s %d\n", q, coeff_format(x));
+}
+
+static const struct {
+  const char *name;
+  size_t offset;
+} coeff_fields[] = {
+  {"PHI11", offsetof(coeffs_t, phi11)}, {"PHI21", offsetof(coeffs_t, phi21)},
+  {"GAMMA1", offsetof(coeffs_t, gamma1)}, {"GAMMA2", offsetof(coeffs_t, gamma2)},
+  {"K1", offsetof(coeffs_t, k1)}, {"K2", offsetof(coeffs_t, k2)},
+  {"KR", offsetof(coeffs_t, kr)}, {"L1", offsetof(coeffs_t, l1)},
+  {"L2", offsetof(coeffs_t, l2)}, {"LV", offsetof(coeffs_t, lv)},
+};
+
+#define COEFF_FIELDS (sizeof coeff_fields / sizeof coeff_fields[0])
+
+/**
+ * Outer loop of the cascade at the outer period H: the state feedback
+ * of coeff_design() for the states [vel pos], with the inner loop
+ * taken as the first-order lag CASC_WI / (s + CASC_WI) from vref to
+ * vel. Both states are measured, so the observer is not used.
+ */
+static void casc_outer(double H, coeffs_t *c) {
+  double complex s = CASC_WO * (-CASC_ZO + I * sqrt(1 - CASC_ZO * CASC_ZO));
+  plant_t p;
+
+  plant_init_model(&p, H, CASC_WI, CASC_WI, PLANT_C);
+  coeff_design(&p, cexp(s * H), 0.5, 0.5, c);
+}
+
+/**
+ * The share of the int16_t range a coefficient may use, in words
+ */
+static const char *coeff_share(void) {
+  static const char *const share[] = {"all of", "half", "a quarter of", "an eighth of"};
+  static char other[32];
+  if (COEFF_HEADROOM < 4) return share[COEFF_HEADROOM];
+  snprintf(other, sizeof other, "1/%d of", 1 << COEFF_HEADROOM);
+  return other;
+}
+
+int main(int argc, char **argv) {
+  /* PI on b/(s + a): s^2 + (a + b K) s + b K / Ti = s^2 + 2 z w s + w^2 */
+  double casc_k = (2 * CASC_ZI * CASC_WI - PLANT_A) / PLANT_B;
+  double casc_ti = PLANT_B * casc_k / (CASC_WI * CASC_WI);
+  int i;
+  size_t j;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <sample period in ms>... > coeffs.h\n", argv[0]);
+    return 2;
+  }
+
+  printf("/**\n"
+         " * Controller coefficients for the sample period selected in sampling.h.\n"
+         " *\n"
+         " * Generated by host/coeffgen.c, do not edit. To change the design or\n"
+         " * add a sample period, edit and rerun the generator:\n"
+         " *   ./coeffgen");
+  for (i = 1; i < argc; i++) printf(" %s", argv[i]);
+  printf(" > coeffs.h\n"
+         " *\n"
+         " * Position controller: the model in host/plant.h sampled with\n"
+         " * zero-order hold (phi, gamma), state feedback K = [k1 k2] and kr, and\n"
+         " * observer gains L = [l1 l2 lv] for the model augmented with an input\n"
+         " * disturbance v. Every period has the poles of the 50 ms lab design,\n"
+         " * 0.8 +- 0.1i and observer 0.6 +- 0.2i, 0.55, mapped by z = exp(s h).\n"
+         " * phi12 = 0 and phi22 = 1 for every period.\n"
+         " *\n"
+         " * Velocity controller: PI with PI_K, PI_TI and PI_B, and back-calculation\n"
+         " * anti-windup with tracking time constant PI_TR.\n"
+         " *\n"
+         " * Cascade controller: inner velocity PI with CASC_K and CASC_TI, poles at\n"
+         " * %g rad/s, damping %g. Its set-point weight is b = 1, since the\n"
+         " * velocity reference comes from the outer loop, which already shapes\n"
+         " * it, and a smaller b would slow the inner response that the outer\n"
+         " * design assumes. Its anti-windup tracking time constant is Tr = Ti,\n"
+         " * the form that keeps the integral within the output range (see\n"
+         " * cascfixed.c). Outer loop: state feedback CASC_K1, CASC_K2 and\n"
+         " * CASC_KR on the measured velocity and position, as in the position\n"
+         " * controller, with poles at %g rad/s, damping %g, at the outer period\n"
+         " * CASC_DIV h.\n"
+         " *\n"
+         " * For posfixed.c and velfixed.c, <NAME>_Q is the number of fractional\n"
+         " * bits of each coefficient, chosen per period so that the value uses\n"
+         " * at most %s the int16_t range, and <NAME>_FX the coefficient in\n"
+         " * that format. For cascfixed.c the formats are the same for every\n"
+         " * period: 10 fractional bits for the cascade gain K above 4, 13 for\n"
+         " * the rest. The values are computed and range-checked by the\n"
+         " * compiler, see FIXED_CONST() in fixedpoint.h.\n"
+         " */\n"
+         "\n"
+         "#ifndef COEFFS_H\n"
+         "#define COEFFS_H\n"
+         "\n"
+         "#include \"sampling.h\"\n"
+         "#include \"fixedpoint.h\"\n"
+         "\n", CASC_WI, CASC_ZI, CASC_WO, CASC_ZO, coeff_share());
+
+  for (i = 1; i < argc; i++) {
+    int ms = atoi(argv[i]);
+    double h = ms / 1000.0;
+    coeffs_t c, casc;
+    plant_t p;
+
+    if (ms <= 0) {
+      fprintf(stderr, "%s: bad sample period\n", argv[i]);
+      return 2;
+    }
+    plant_init(&p, h);
+    coeff_design(&p, coeff_pole(POLE_C, h), coeff_pole(POLE_O, h),
+                 creal(coeff_pole(POLE_V, h)), &c);
+    printf("#%s SAMPLE_MS == %d\n", i == 1 ? "if" : "elif", ms);
+    for (j = 0; j < COEFF_FIELDS; j++)
+      coeff_print(coeff_fields[j].name,
+                  *(const double *) ((const char *) &c + coeff_fields[j].offset));
+    for (j = 0; j < COEFF_FIELDS; j++)
+      coeff_print_format(coeff_fields[j].name,
+                         *(const double *) ((const char *) &c + coeff_fields[j].offset));
+    coeff_print_format("KH_TI", PI_K * h / PI_TI);
+    coeff_print_format("H_TR", h / PI_TR);
+    casc_outer(CASC_DIV * h, &casc);
+    coeff_print("CASC_K1", casc.k1);
+    coeff_print("CASC_K2", casc.k2);
+    coeff_print("CASC_KR", casc.kr);
+    printf("\n");
+  }
+
+  printf("#else\n"
+         "#error \"No coefficients for this SAMPLE_MS, rerun host/coeffgen.c\"\n"
+         "#endif\n"
+         "\n");
+  coeff_print("PI_K", PI_K);
+  coeff_print("PI_TI", PI_TI);
+  coeff_print("PI_B", PI_B);
+  coeff_print("PI_TR", PI_TR);
+  printf("#define KH_TI      (PI_K * SAMPLE_H / PI_TI)\n"
+         "#define H_TR       (SAMPLE_H / PI_TR)\n");
+  coeff_print_format("PI_K", PI_K);
+  coeff_print_format("PI_KB", PI_K * PI_B);
+  printf("\n");
+  coeff_print("CASC_K", casc_k);
+  coeff_print("CASC_TI", casc_ti);
+  printf("#define CASC_H_TI  (SAMPLE_H / CASC_TI)\n"
+         "#define CASC_DIV   %d\n"
+         "#define CASC_K_Q   10\n"
+         "#define CASC_H_TI_Q 13\n"
+         "#define CASC_K1_Q  13\n"
+         "#define CASC_K2_Q  13\n"
+         "#define CASC_KR_Q  13\n"
+         "\n", CASC_DIV);
+
+  for (j = 0; j < COEFF_FIELDS; j++) {
+    char q[16];
+    snprintf(q, sizeof q, "%s_FX", coeff_fields[j].name);
+    printf("#define %-10s FIXED_CONST(%s, %s_Q)\n", q, coeff_fields[j].name,
+           coeff_fields[j].name);
+  }
+  printf("#define PI_K_FX    FIXED_CONST(PI_K, PI_K_Q)\n"
+         "#define PI_KB_FX   FIXED_CONST(PI_K * PI_B, PI_KB_Q)\n"
+         "#define KH_TI_FX   FIXED_CONST(KH_TI, KH_TI_Q)\n"
+         "#define H_TR_FX    FIXED_CONST(H_TR, H_TR_Q)\n"
+         "#define CASC_K_FX  FIXED_CONST(CASC_K, CASC_K_Q)\n"
+         "#define CASC_H_TI_FX FIXED_CONST(CASC_H_TI, CASC_H_TI_Q)\n"
+         "#define CASC_K1_FX FIXED_CONST(CASC_K1, CASC_K1_Q)\n"
+         "#define CASC_K2_FX FIXED_CONST(CASC_K2, CASC_K2_Q)\n"
+         "#define CASC_KR_FX FIXED_CONST(CASC_KR, CASC_KR_Q)\n"
+         "\n");
+  for (j = 0; j < COEFF_FIELDS; j++)
+    printf("FIXED_CHECK(%s, %s_Q);\n", coeff_fields[j].name, coeff_fields[j].name);
+  printf("FIXED_CHECK(PI_K, PI_K_Q);\n"
+         "FIXED_CHECK(PI_K * PI_B, PI_KB_Q);\n"
+         "FIXED_CHECK(KH_TI, KH_TI_Q);\n"
+         "FIXED_CHECK(H_TR, H_TR_Q);\n"
+         "FIXED_CHECK(CASC_K, CASC_K_Q);\n"
+         "FIXED_CHECK(CASC_H_TI, CASC_H_TI_Q);\n"
+         "FIXED_CHECK(CASC_K1, CASC_K1_Q);\n"
+         "FIXED_CHECK(CASC_K2, CASC_K2_Q);\n"
+         "FIXED_CHECK(CASC_KR, CASC_KR_Q);\n"
+         "\n"
+         "#endif\n");
+  return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * Controller design shared by the host tools: the poles of the
+ * position controller and the velocity PI parameters of the lab
+ * design, pole placement for the DC-servo model of plant.h, and the
+ * choice of the fixed-point format of a coefficient. host/coeffgen.c
+ * computes coeffs.h from the design here; host/gainsweep.c searches
+ * for a better one and prints it as a header that replaces the
+ * POLE_ or PI_ values below with gcc -include.
+ *
+ * The poles are given for the period DESIGN_H and mapped to other
+ * periods through z = exp(s h) (coeff_pole()).
+ */
+
+#ifndef HOST_DESIGN_H
+#define HOST_DESIGN_H
+
+#include <math.h>
+#include <complex.h>
+#include "plant.h"
+
+#define DESIGN_H   0.05              /* Period the poles below are given for */
+#ifndef POLE_C
+#define POLE_C     (0.8 + 0.1 * I)   /* State feedback, and its conjugate */
+#define POLE_O     (0.6 + 0.2 * I)   /* Observer, and its conjugate */
+#define POLE_V     0.55              /* Observer, disturbance state */
+#endif
+
+#ifndef PI_K
+#define PI_K       2.6133            /* Velocity PI controller */
+#define PI_TI      0.4523
+#define PI_B       0.5
+#endif
+#ifndef PI_TR
+#define PI_TR      0.25              /* Anti-windup tracking time constant */
+#endif
+
+typedef struct {
+  double phi11, phi21, gamma1, gamma2;
+  double k1, k2, kr;
+  double l1, l2, lv;
+} coeffs_t;
+
+/**
+ * Map a pole given for DESIGN_H to the period h
+ */
+static inline double complex coeff_pole(double complex z, double h) {
+  return cexp(clog(z) / DESIGN_H * h);
+}
+
+/**
+ * Solve the 3x3 system a x = b by Gaussian elimination
+ */
+static void coeff_solve3(double a[3][3], const double b[3], double x[3]) {
+  double m[3][4];
+  int i, j, c;
+
+  for (i = 0; i < 3; i++) {
+    for (j = 0; j < 3; j++) m[i][j] = a[i][j];
+    m[i][3] = b[i];
+  }
+  for (c = 0; c < 3; c++) {
+    int p = c;
+    for (i = c + 1; i < 3; i++)
+      if (fabs(m[i][c]) > fabs(m[p][c])) p = i;
+    for (j = 0; j < 4; j++) {
+      double t = m[c][j];
+      m[c][j] = m[p][j];
+      m[p][j] = t;
+    }
+    for (i = 0; i < 3; i++) {
+      if (i == c) continue;
+      double f = m[i][c] / m[c][c];
+      for (j = 0; j < 4; j++) m[i][j] -= f * m[c][j];
+    }
+  }
+  for (i = 0; i < 3; i++) x[i] = m[i][3] / m[i][i];
+}
+
+static void coeff_mul3(double a[3][3], double b[3][3], double c[3][3]) {
+  int i, j, k;
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++) {
+      c[i][j] = 0;
+      for (k = 0; k < 3; k++) c[i][j] += a[i][k] * b[k][j];
+    }
+}
+
+/**
+ * Position controller for the sampled model pl: state feedback with
+ * the closed-loop poles zc and its conjugate, kr for unit static gain,
+ * and the observer for the model augmented with an input disturbance
+ * with the poles zo, its conjugate and zv
+ */
+static inline void coeff_design(const plant_t *pl, double complex zc, double complex zo,
+                                double zv, coeffs_t *c) {
+  const plant_t p = *pl;
+  int i, j;
+
+  c->phi11 = p.phi11;
+  c->phi21 = p.phi21;
+  c->gamma1 = p.gamma1;
+  c->gamma2 = p.gamma2;
+
+  /*
+   * State feedback, Phi = [phi11 0; phi21 1], Gamma = [gamma1; gamma2]:
+   * K = [0 1] Wc^-1 P(Phi), Wc = [Gamma Phi*Gamma], with the desired
+   * characteristic polynomial P(z) = z^2 + a1 z + a2.
+   */
+  double a1 = -2 * creal(zc), a2 = creal(zc * conj(zc));
+  double w11 = p.gamma1, w12 = p.phi11 * p.gamma1;
+  double w21 = p.gamma2, w22 = p.phi21 * p.gamma1 + p.gamma2;
+  double det = w11 * w22 - w12 * w21;
+  double pd11 = p.phi11 * p.phi11 + a1 * p.phi11 + a2;
+  double pd21 = p.phi21 * p.phi11 + p.phi21 + a1 * p.phi21;
+  double pd22 = 1 + a1 + a2;
+  c->k1 = (-w21 * pd11 + w11 * pd21) / det;
+  c->k2 = (w11 * pd22) / det;
+
+  /* kr for y/r = 1 in stationarity: y = C (I - Phi + Gamma K)^-1 Gamma kr */
+  double m11 = 1 - p.phi11 + p.gamma1 * c->k1, m12 = p.gamma1 * c->k2;
+  double m21 = -p.phi21 + p.gamma2 * c->k1, m22 = p.gamma2 * c->k2;
+  c->kr = (m11 * m22 - m12 * m21) / (m11 * p.gamma2 - m21 * p.gamma1);
+
+  /*
+   * Observer for the model augmented with an input disturbance v,
+   * F = [Phi Gamma; 0 1], measured output y = x2:
+   * L = P(F) O^-1 [0 0 1]^T, O = [C; C F; C F^2].
+   */
+  double f[3][3] = {{p.phi11, 0, p.gamma1}, {p.phi21, 1, p.gamma2}, {0, 0, 1}};
+  double f2[3][3], f3[3][3], pf[3][3], o[3][3], x[3];
+  static const double e3[3] = {0, 0, 1};
+  double m = creal(zo * conj(zo));
+  double b1 = -2 * creal(zo) - zv, b2 = m + 2 * creal(zo) * zv, b3 = -m * zv;
+
+  coeff_mul3(f, f, f2);
+  coeff_mul3(f2, f, f3);
+  for (i = 0; i < 3; i++)
+    for (j = 0; j < 3; j++)
+      pf[i][j] = f3[i][j] + b1 * f2[i][j] + b2 * f[i][j] + b3 * (i == j);
+  for (j = 0; j < 3; j++) {
+    o[0][j] = j == 1;
+    o[1][j] = f[1][j];
+    o[2][j] = f2[1][j];
+  }
+  coeff_solve3(o, e3, x);
+  c->l1 = pf[0][0] * x[0] + pf[0][1] * x[1] + pf[0][2] * x[2];
+  c->l2 = pf[1][0] * x[0] + pf[1][1] * x[1] + pf[1][2] * x[2];
+  c->lv = pf[2][0] * x[0] + pf[2][1] * x[1] + pf[2][2] * x[2];
+}
+
+#ifndef COEFF_HEADROOM
+#define COEFF_HEADROOM 1            /* bits of the int16_t range left free */
+#endif
+
+/**
+ * Fractional bits for x: the most, up to 30, with |x| 2^n within the
+ * int16_t range less COEFF_HEADROOM bits, 16383 for the default 1
+ */
+static inline int coeff_format(double x) {
+  int n = 0;
+  while (n < 30 && fabs(x) * ldexp(1, n + 1) <= (INT16_MAX >> COEFF_HEADROOM)) n++;
+  return n;
+}
+
+#endif
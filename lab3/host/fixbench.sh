@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Fixed-point versus floating-point comparison of the controllers.
+#
+# For each pair (posfloat.c/posfixed.c, velfloat.c/velfixed.c) the
+# floating-point controller is run closed loop in servosim and its AD
+# input is recorded. The fixed-point controller is then run
+#   open loop    on the recorded input, so that any difference in u
+#                and the states is numerical error of the fixed-point
+#                arithmetic alone, and
+#   closed loop  against the plant, which shows what that error does
+#                to the control, including the plant's reaction to it.
+# host/tracecmp.c reports the RMS and maximum differences. The host
+# time per control step is measured in separate runs without traces.
+#
+# If avr-gcc is installed, the flash and RAM use and the size of the
+# control interrupt are printed for the ATmega16. Cycle counts have to
+# be measured on the target: build with -DPROFILE and send 'p'
+# (profiler.h).
+#
+# To run, from the lab3 directory:
+#   sh host/fixbench.sh [control steps, default 200000] [SAMPLE_MS, default 50]
+
+set -e
+
+steps=${1:-200000}
+ms=${2:-50}
+tmp=${TMPDIR:-/tmp}/fixbench.$$
+mkdir -p "$tmp"
+trap 'rm -rf "$tmp"' EXIT
+
+gcc -O2 -Wall -o "$tmp/tracecmp" host/tracecmp.c -lm
+for c in posfloat posfixed velfloat velfixed; do
+  gcc -O2 -Wall -DHOST -DSAMPLE_MS="$ms" -DCONTROLLER="\"$c.c\"" -I. \
+      -o "$tmp/$c" host/servosim.c -lm
+done
+
+for pair in pos vel; do
+  fl=${pair}float
+  fx=${pair}fixed
+  echo "== $fl.c vs $fx.c, $steps steps of $ms ms"
+  "$tmp/$fl" -n "$steps" -w "$tmp/input" -s "$tmp/$fl.trace" > /dev/null
+  "$tmp/$fx" -n "$steps" -i "$tmp/input" -s "$tmp/$fx.open" > /dev/null
+  "$tmp/$fx" -n "$steps" -s "$tmp/$fx.closed" > /dev/null
+  echo "-- open loop, same input"
+  "$tmp/tracecmp" "$tmp/$fl.trace" "$tmp/$fx.open"
+  echo "-- closed loop"
+  "$tmp/tracecmp" "$tmp/$fl.trace" "$tmp/$fx.closed"
+  echo "-- host time"
+  for c in $fl $fx; do
+    printf '  %-9s %s ns/step\n' "$c" "$("$tmp/$c" -n "$steps" | sed -n 's/^ns\/step *//p')"
+  done
+  if command -v avr-gcc > /dev/null; then
+    echo "-- ATmega16"
+    for c in $fl $fx; do
+      avr-gcc -mmcu=atmega16 -O -Wall -DSAMPLE_MS="$ms" -o "$tmp/$c.elf" $c.c
+      isr=$(avr-nm -S "$tmp/$c.elf" | awk '/ __vector_3$/ { print $2 }')  # TIMER2_COMP
+      isr=$((0x${isr:-0}))
+      avr-size "$tmp/$c.elf" | awk -v c="$c" -v isr="$isr" \
+        'NR == 2 { printf "  %-9s flash %d, ram %d, control interrupt %s bytes\n", c, $1 + $2, $2 + $3, isr }'
+    done
+  fi
+  echo
+done
@@ -0,0 +1,329 @@
+/**
+ * Check the fixedpoint.h kernels against the functions they replaced.
+ *
+ * add_13, sub_13, mul_13 and div_13 are compared with copies of the
+ * int32_t versions that posfixed.c and velfixed.c had before
+ * fixedpoint.h, for every pair of int16_t operands.
+ *
+ * The accumulator path, which has no old version, is compared with
+ * the same operations in 64 bits, clamped once at the end: round_13
+ * and fixed_round() by 0 bits for every int32_t accumulator, and
+ * mac_13, msc_13, acc_add_13 and acc_sub_13 for FIX_RANDOM random
+ * operands, a third of the
+ * accumulators within 2^31 of INT32_MAX or INT32_MIN so that the
+ * accumulator saturates often. For these the kernels must also report
+ * a clamp to SAT_EVENT() exactly when the 64-bit result is out of
+ * range.
+ *
+ * The typed operations (q_add, q_sub, q_mac, q_msc, q_acc_add,
+ * q_acc_sub, q_conv and q_mul) are compared the same way, for
+ * FIX_TYPED random operands in each of the format combinations of
+ * fix_test_typed(), chosen so that every alignment shift is up, down
+ * and none somewhere, and rounding to Q0 from Q0 is among them. The
+ * reference rounds each aligned term to nearest, ties towards +inf,
+ * and clamps it to 32 bits, then clamps the sum, as fixedpoint.h
+ * specifies.
+ *
+ * Built with -DFIX_MISMATCH=n, n = 1..FIX_MISMATCHES, it instead
+ * contains one misuse of the typed formats, e.g. adding a Q13 to a
+ * Q12, which must not compile; host/fixtest.sh checks each of them.
+ *
+ * Every mismatch is counted and the first few are printed; the exit
+ * status is 1 if there was any.
+ *
+ * To compile, from the lab3 directory:
+ *   gcc -O2 -Wall -I. -o fixtest host/fixtest.c
+ *
+ * To run (about a minute):
+ *   ./fixtest
+ * or, with the compile checks:
+ *   sh host/fixtest.sh
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+static long fix_events;             /* clamps reported by the kernels */
+#define SAT_EVENT() (fix_events++)
+
+#include "fixedpoint.h"
+
+#define Q 13
+#define FIX_RANDOM (1L << 28)
+#define FIX_TYPED  (1L << 24)
+#define FIX_MISMATCHES 6
+
+FIXED_DEFINE_Q(13)
+
+static inline int16_t old_add_13(int32_t x, int32_t y) {
+  int32_t result = x + y;
+  if (result > INT16_MAX) return INT16_MAX;
+  if (result < INT16_MIN) return INT16_MIN;
+  return (int16_t) result;
+}
+
+static inline int16_t old_sub_13(int32_t x, int32_t y) {
+  int32_t result = x - y;
+  if (result > INT16_MAX) return INT16_MAX;
+  if (result < INT16_MIN) return INT16_MIN;
+  return (int16_t) result;
+}
+
+static inline int16_t old_mul_13(int32_t x, int32_t y) {
+  int32_t result = x * y;
+  result = (result + (1 << (Q - 1))) >> Q;
+  if (result > INT16_MAX) return INT16_MAX;
+  if (result < INT16_MIN) return INT16_MIN;
+  return (int16_t) result;
+}
+
+static inline int16_t old_div_13(int32_t x, int32_t y) {
+  int32_t result;
+  if (y == 0) return 0;
+  result = x << Q;
+  result = result / y;
+  if (result > INT16_MAX) return INT16_MAX;
+  if (result < INT16_MIN) return INT16_MIN;
+  return (int16_t) result;
+}
+
+static long fix_errors = 0;
+
+static void fix_report(const char *op, int32_t x, int32_t y, int16_t got, int16_t want) {
+  if (fix_errors++ < 10)
+    printf("%s(%" PRId32 ", %" PRId32 ") = %d, was %d\n", op, x, y, got, want);
+}
+
+/**
+ * Clamp a 64-bit result to [lo, hi], noting in *clamped whether it was
+ */
+static int64_t fix_clamp(int64_t v, int64_t lo, int64_t hi, int *clamped) {
+  *clamped = v < lo || v > hi;
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+/**
+ * Check an accumulator result against the 64-bit one and the clamp
+ * reported against the one expected
+ */
+static void fix_check_acc(const char *op, int32_t acc, int16_t k, int16_t x,
+                          fixed_acc_t got, int64_t exact) {
+  int clamped;
+  int64_t want = fix_clamp(exact, INT32_MIN, INT32_MAX, &clamped);
+  if (got != want || (fix_events != 0) != clamped) {
+    if (fix_errors++ < 10)
+      printf("%s(%" PRId32 ", %d, %d) = %" PRId32 ", %ld clamps, was %" PRId64 ", %d\n",
+             op, acc, k, x, got, fix_events, want, clamped);
+  }
+  fix_events = 0;
+}
+
+/**
+ * xorshift64
+ */
+static uint64_t fix_random(void) {
+  static uint64_t s = 0x9e3779b97f4a7c15u;
+  s ^= s << 13;
+  s ^= s >> 7;
+  s ^= s << 17;
+  return s;
+}
+
+/**
+ * A random accumulator: uniform, or within 2^31 of either limit
+ */
+static int32_t fix_random_acc(void) {
+  uint64_t v = fix_random();
+  switch (v % 3) {
+  case 0: return (int32_t) (uint32_t) (v >> 32);
+  case 1: return INT32_MAX - (int32_t) (v >> 33);
+  default: return INT32_MIN + (int32_t) (v >> 33);
+  }
+}
+
+/**
+ * round_13 for every accumulator: round to nearest, ties towards +inf,
+ * by floor division in 64 bits; and fixed_round() by no bits, which
+ * only saturates
+ */
+static void fix_test_round(void) {
+  int64_t a;
+  for (a = INT32_MIN; a <= INT32_MAX; a++) {
+    int64_t t = a + (1 << (Q - 1)), f = t / (1 << Q);
+    int clamped;
+    int16_t got;
+    if (t % (1 << Q) != 0 && t < 0) f--;
+    f = fix_clamp(f, INT16_MIN, INT16_MAX, &clamped);
+    fix_events = 0;
+    got = round_13((fixed_acc_t) a);
+    if (got != f || (fix_events != 0) != clamped) {
+      if (fix_errors++ < 10)
+        printf("round_13(%" PRId64 ") = %d, %ld clamps, was %" PRId64 ", %d\n",
+               a, got, fix_events, f, clamped);
+    }
+    f = fix_clamp(a, INT16_MIN, INT16_MAX, &clamped);
+    fix_events = 0;
+    got = fixed_round((fixed_acc_t) a, 0);
+    if (got != f || (fix_events != 0) != clamped) {
+      if (fix_errors++ < 10)
+        printf("fixed_round(%" PRId64 ", 0) = %d, %ld clamps, was %" PRId64 ", %d\n",
+               a, got, fix_events, f, clamped);
+    }
+  }
+  fix_events = 0;
+}
+
+static void fix_test_acc(void) {
+  long i;
+  for (i = 0; i < FIX_RANDOM; i++) {
+    uint64_t v = fix_random();
+    int32_t acc = fix_random_acc();
+    int16_t k = (int16_t) v, x = (int16_t) (v >> 16);
+    int64_t p = (int64_t) k * x, a = (int64_t) x << Q;
+    fix_check_acc("mac_13", acc, k, x, mac_13(acc, k, x), acc + p);
+    fix_check_acc("msc_13", acc, k, x, msc_13(acc, k, x), acc - p);
+    fix_check_acc("acc_add_13", acc, 0, x, acc_add_13(acc, x), acc + a);
+    fix_check_acc("acc_sub_13", acc, 0, x, acc_sub_13(acc, x), acc - a);
+  }
+}
+
+/**
+ * A 64-bit value shifted from s more fractional bits than the target
+ * (s < 0: fewer), rounded to nearest, ties towards +inf, by floor
+ * division
+ */
+static int64_t fix_shift(int64_t v, int s) {
+  int64_t d, f;
+  if (s <= 0) return v * ((int64_t) 1 << -s);
+  d = (int64_t) 1 << s;
+  v += d / 2;
+  f = v / d;
+  if (v % d != 0 && v < 0) f--;
+  return f;
+}
+
+/**
+ * An aligned term added to an accumulator: the term clamped to 32
+ * bits, then the sum
+ */
+static int64_t fix_acc_ref(int32_t acc, int64_t term, int s, int *clamped) {
+  int c1, c2;
+  int64_t t = fix_clamp(fix_shift(term, s), INT32_MIN, INT32_MAX, &c1);
+  int64_t sum = fix_clamp(acc + t, INT32_MIN, INT32_MAX, &c2);
+  *clamped = c1 || c2;
+  return sum;
+}
+
+/**
+ * Check a typed result against the reference and the clamp reported
+ * against the one expected
+ */
+static void fix_check_typed(const char *op, const char *formats, int64_t got,
+                            int64_t want, int clamped) {
+  if (got != want || (fix_events != 0) != clamped) {
+    if (fix_errors++ < 10)
+      printf("%s %s = %" PRId64 ", %ld clamps, was %" PRId64 ", %d\n",
+             op, formats, got, fix_events, want, clamped);
+  }
+  fix_events = 0;
+}
+
+/* Defines fix_typed_<k>_<x>_<a>_<t>(): coefficient k, value x,
+   accumulator a and target t fractional bits */
+#define FIX_DEFINE_TYPED(fk, fx, fa, ft)                                      \
+  static void fix_typed_##fk##_##fx##_##fa##_##ft(void) {                     \
+    const char *f = "(" #fk ", " #fx ", " #fa ", " #ft ")";                   \
+    long i;                                                                   \
+    int c;                                                                    \
+    for (i = 0; i < FIX_TYPED; i++) {                                         \
+      uint64_t v = fix_random();                                              \
+      q##fk##_t k = { (int16_t) v };                                          \
+      q##fx##_t x = { (int16_t) (v >> 16) }, y = { (int16_t) (v >> 32) };     \
+      acc##fa##_t acc = { fix_random_acc() };                                 \
+      int64_t p = (int64_t) k.raw * x.raw, w;                                 \
+      w = fix_clamp((int64_t) x.raw + y.raw, INT16_MIN, INT16_MAX, &c);       \
+      fix_check_typed("q_add", f, q_add(x, y).raw, w, c);                     \
+      w = fix_clamp((int64_t) x.raw - y.raw, INT16_MIN, INT16_MAX, &c);       \
+      fix_check_typed("q_sub", f, q_sub(x, y).raw, w, c);                     \
+      w = fix_acc_ref(acc.raw, p, fk + fx - fa, &c);                          \
+      fix_check_typed("q_mac", f, q_mac(acc, k, x).raw, w, c);                \
+      w = fix_acc_ref(acc.raw, -p, fk + fx - fa, &c);                         \
+      fix_check_typed("q_msc", f, q_msc(acc, k, x).raw, w, c);                \
+      w = fix_acc_ref(acc.raw, x.raw, fx - fa, &c);                           \
+      fix_check_typed("q_acc_add", f, q_acc_add(acc, x).raw, w, c);           \
+      w = fix_acc_ref(acc.raw, -x.raw, fx - fa, &c);                          \
+      fix_check_typed("q_acc_sub", f, q_acc_sub(acc, x).raw, w, c);           \
+      w = fix_clamp(fix_shift(acc.raw, fa - ft), INT16_MIN, INT16_MAX, &c);   \
+      fix_check_typed("q_conv acc", f, q_conv(q##ft##_t, acc).raw, w, c);     \
+      w = fix_clamp(fix_shift(x.raw, fx - ft), INT16_MIN, INT16_MAX, &c);     \
+      fix_check_typed("q_conv", f, q_conv(q##ft##_t, x).raw, w, c);           \
+      w = fix_clamp(fix_shift(p, fk + fx - ft), INT16_MIN, INT16_MAX, &c);    \
+      fix_check_typed("q_mul", f, q_mul(q##ft##_t, k, x).raw, w, c);          \
+    }                                                                         \
+  }
+
+FIX_DEFINE_TYPED(13, 2, 13, 0)      /* the position controller's shape */
+FIX_DEFINE_TYPED(5, 5, 10, 5)
+FIX_DEFINE_TYPED(2, 0, 9, 12)       /* every shift up */
+FIX_DEFINE_TYPED(15, 14, 0, 0)      /* accumulator and target in Q0 */
+FIX_DEFINE_TYPED(0, 0, 30, 30)
+FIX_DEFINE_TYPED(17, 13, 1, 1)      /* rounding by one bit */
+
+#define FIX_TYPED_FORMATS 6
+
+static void fix_test_typed(void) {
+  fix_typed_13_2_13_0();
+  fix_typed_5_5_10_5();
+  fix_typed_2_0_9_12();
+  fix_typed_15_14_0_0();
+  fix_typed_0_0_30_30();
+  fix_typed_17_13_1_1();
+}
+
+#if FIX_MISMATCH
+/**
+ * One misuse of the typed formats, which must not compile
+ */
+static void fix_mismatch(void) {
+  q13_t a = {1};
+  q12_t b = {1};
+  acc13_t acc = {0};
+  int16_t raw = 1;
+#if FIX_MISMATCH == 1
+  a = q_add(a, b);                  /* different formats */
+#elif FIX_MISMATCH == 2
+  a = q_sub(a, b);
+#elif FIX_MISMATCH == 3
+  a = b;                            /* assignment across formats */
+#elif FIX_MISMATCH == 4
+  a = q_add(a, raw);                /* a bare int16_t */
+#elif FIX_MISMATCH == 5
+  acc = q_mac(acc, raw, a);         /* a coefficient without a format */
+#elif FIX_MISMATCH == 6
+  raw = q_conv(int16_t, acc);       /* a target without a format */
+#endif
+  (void) a; (void) b; (void) acc; (void) raw;
+}
+#endif
+
+int main(void) {
+  int32_t x, y;
+
+  for (x = INT16_MIN; x <= INT16_MAX; x++) {
+    for (y = INT16_MIN; y <= INT16_MAX; y++) {
+      int16_t a = (int16_t) x, b = (int16_t) y, got, want;
+      if ((got = add_13(a, b)) != (want = old_add_13(x, y))) fix_report("add_13", x, y, got, want);
+      if ((got = sub_13(a, b)) != (want = old_sub_13(x, y))) fix_report("sub_13", x, y, got, want);
+      if ((got = mul_13(a, b)) != (want = old_mul_13(x, y))) fix_report("mul_13", x, y, got, want);
+      if ((got = div_13(a, b)) != (want = old_div_13(x, y))) fix_report("div_13", x, y, got, want);
+    }
+  }
+  fix_events = 0;
+  fix_test_round();
+  fix_test_acc();
+  fix_test_typed();
+  printf("%ld mismatches in 4 x 2^32 operand pairs, 2^32 accumulators,"
+         " 4 x %ld random operands and %d x 9 x %ld typed ones\n", fix_errors,
+         FIX_RANDOM, FIX_TYPED_FORMATS, FIX_TYPED);
+  return fix_errors != 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Tests of the fixed-point library, fixedpoint.h.
+#
+# Builds host/fixtest.c once with each -DFIX_MISMATCH=n, a misuse of
+# the typed formats such as adding a Q13 to a Q12, and fails if any of
+# them compiles. Then builds it normally and runs it, which compares
+# the kernels and the typed operations with 64-bit references.
+#
+# To run, from the lab3 directory:
+#   sh host/fixtest.sh
+
+set -e
+
+tmp=${TMPDIR:-/tmp}/fixtest.$$
+mkdir -p "$tmp"
+trap 'rm -rf "$tmp"' EXIT
+fail=0
+
+n=$(sed -n 's/^#define FIX_MISMATCHES *//p' host/fixtest.c)
+# Past the last misuse the same code must compile, or the checks prove nothing
+if ! gcc -O2 -DFIX_MISMATCH=$((n + 1)) -I. -o "$tmp/mismatch" host/fixtest.c; then
+  echo "FIX_MISMATCH=$((n + 1)): does not compile without a misuse"
+  exit 1
+fi
+i=1
+while [ "$i" -le "$n" ]; do
+  if gcc -O2 -Wall -DFIX_MISMATCH="$i" -I. -o "$tmp/mismatch" host/fixtest.c 2> /dev/null; then
+    echo "FIX_MISMATCH=$i: compiles, but must not"
+    fail=1
+  fi
+  i=$((i + 1))
+done
+echo "$n misuses of the typed formats checked"
+
+gcc -O2 -Wall -I. -o "$tmp/fixtest" host/fixtest.c
+"$tmp/fixtest" || fail=1
+
+exit $fail
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Gain search over the coefficient formats as well as the gains.
+#
+# The formats of the coefficients are types of the controller
+# (fixedpoint.h), so host/gainsweep.c searches the gains for the
+# formats it is compiled with. This runs it once per format choice:
+# for each COEFF_HEADROOM in FORMATS (default "0 1 2 3"), the bits of
+# the int16_t range left free above each coefficient of the current
+# design (coeff_format() in host/design.h), coeffs.h is generated with
+# those formats, gainsweep is compiled against it and run with the
+# given arguments. Less headroom means more fractional bits but fewer
+# candidates that fit; more means coarser coefficients with room for
+# larger gains.
+#
+# The best design of each run is listed on stderr, and the winner over
+# all of them, ranked as gainsweep ranks candidates, is printed as its
+# header, which sets COEFF_HEADROOM too, so that coeffgen chooses the
+# new formats the same way:
+#   sh host/formatsweep.sh posfixed.c 50 -n 20000 > sweep.h
+#   gcc -O2 -Wall -I. -include sweep.h -o coeffgen host/coeffgen.c -lm
+#   ./coeffgen 50 20 10 5 2 > coeffs.h
+#
+# To run, from the lab3 directory:
+#   sh host/formatsweep.sh <posfixed.c | velfixed.c> [SAMPLE_MS, default 50]
+#                          [gainsweep arguments]
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "usage: sh host/formatsweep.sh <controller.c> [SAMPLE_MS] [gainsweep arguments]" >&2
+  exit 2
+fi
+c=$1
+shift
+ms=50
+case "$1" in
+  [0-9]*) ms=$1; shift ;;
+esac
+formats=${FORMATS:-0 1 2 3}
+tmp=${TMPDIR:-/tmp}/formatsweep.$$
+mkdir -p "$tmp"
+trap 'rm -rf "$tmp"' EXIT
+
+for h in $formats; do
+  gcc -O2 -Wall -DCOEFF_HEADROOM="$h" -I. -o "$tmp/coeffgen" host/coeffgen.c -lm
+  "$tmp/coeffgen" "$ms" > "$tmp/coeffs.$h.h"
+  gcc -O2 -Wall -DHOST -DSAMPLE_MS="$ms" -DCONTROLLER="\"$c\"" -DCOEFF_HEADROOM="$h" \
+      -I. -include "$tmp/coeffs.$h.h" -o "$tmp/gainsweep" host/gainsweep.c -lm
+  echo "== COEFF_HEADROOM $h" >&2
+  if ! "$tmp/gainsweep" "$@" > "$tmp/sweep.$h.h"; then
+    continue
+  fi
+  sed -n 's/^ \*  *1 /  best /p' "$tmp/sweep.$h.h" >&2
+
+  # The ranking key of gainsweep's best: overflow, not settled,
+  # overshoot over the limit, settling time, saturation
+  limit=$(sed -n 's/.*overshoot limit \([^%]*\)%.*/\1/p' "$tmp/sweep.$h.h")
+  sed -n 's/^ \*  *1 //p' "$tmp/sweep.$h.h" | awk -v h="$h" -v limit="$limit" \
+    '{ inf = $2 == "inf"; over = $3 > limit + 0
+       printf "%d %d %d %s %s %s\n", $5 != 0, inf, over, inf ? 1e9 : $2, $4, h }' >> "$tmp/best"
+done
+
+if [ ! -s "$tmp/best" ]; then
+  echo "no format has a candidate that fits" >&2
+  exit 1
+fi
+h=$(sort -s -k1,1n -k2,2n -k3,3n -k4,4g -k5,5n "$tmp/best" | awk 'NR == 1 { print $6 }')
+echo "== best with COEFF_HEADROOM $h" >&2
+cat "$tmp/sweep.$h.h"
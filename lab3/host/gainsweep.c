@@ -0,0 +1,505 @@
+/**
+ * Parallel gain search for the fixed-point controllers.
+ *
+ * Compiled, like host/servosim.c, with one controller, posfixed.c or
+ * velfixed.c, and run against the DC-servo model of host/plant.h.
+ * Each candidate design is turned into the controller's coefficients
+ * in their fixed-point formats (<NAME>_Q, coeffs.h) and written into
+ * the active parameter bank (params.h). The host-compiled control law
+ * then answers a step of the reference on GS_PLANTS models at once:
+ * the nominal one and the eight corners of a box of +-e around it in
+ * a, b and c. The plants are the controller's axes (AXES, hal.h), each
+ * with states of its own. They are stepped together from a struct
+ * of arrays, a loop the compiler vectorizes; the control law
+ * runs one axis after the other, as it does on the target.
+ *
+ * The control law reads the plants at the sample instant, quantized to
+ * ADC_FRAC_BITS, not through the AD windows of adc.h: with the plants
+ * as axes, adc.h would divide the conversions among 2 * GS_PLANTS
+ * channels, which no board has, and modelling them per plant as
+ * host/servosim.c does would make a candidate some fifty times slower.
+ * The windows' averaging over up to half a period and their delay of
+ * up to one period are therefore not in the scores, which matters more
+ * the shorter SAMPLE_MS; the emitted header says so, and the winner
+ * should be run in servosim before it is flashed.
+ *
+ * The candidates are
+ *   posfixed.c  the closed-loop poles (natural frequency wc in rad/s,
+ *               damping zc), the observer poles (wo, zo) and the
+ *               disturbance pole wv, placed on the nominal model as
+ *               host/coeffgen.c does (host/design.h);
+ *   velfixed.c  PI_K, PI_TI and PI_B, with PI_TR of the design;
+ * drawn at random (-n), log-uniform within gs_ranges[] except for the
+ * dampings and PI_B, or on a grid of -g points per parameter.
+ * Candidate 0 is the current design of host/design.h.
+ *
+ * For every candidate, over the worst of the plants:
+ *   settling time  from the step until y stays within 2% of r
+ *   overshoot      in percent of r
+ *   saturated      control steps with u at the +511/-512 limit
+ *   overflow       fixed-point saturation events (satcount.h),
+ *                  summed over the plants
+ * Candidates whose coefficients do not fit their formats are dropped.
+ * The others are ranked by: no overflow, settled on every plant,
+ * overshoot within -o, then the shortest settling time, then the least
+ * saturation.
+ *
+ * One worker process per core (-j) evaluates the candidates. Each
+ * takes the next block of GS_BLOCK candidates from a counter in shared
+ * memory, so that a worker that finishes early takes over work that
+ * would otherwise wait, and writes the results there. The workers are
+ * processes, not threads, since the controller's states and parameter
+ * bank are globals.
+ *
+ * Prints the ranking of the best -k as a comment and the winner as a
+ * header with the design constants of host/design.h and the
+ * COEFF_HEADROOM the formats were chosen with, from which
+ * host/coeffgen.c computes coeffs.h again, with the formats chosen
+ * the same way for the new coefficients:
+ *   ./gainsweep > sweep.h
+ *   gcc -O2 -Wall -I. -include sweep.h -o coeffgen host/coeffgen.c -lm
+ *   ./coeffgen 50 20 10 5 2 > coeffs.h
+ *
+ * The coefficient formats themselves are types of the controller
+ * (fixedpoint.h), fixed when it is compiled, so one binary searches
+ * the gains for one set of formats, those of coeffs.h. host/formatsweep.sh
+ * searches the formats too: it builds one binary per COEFF_HEADROOM,
+ * against a coeffs.h generated with it, and keeps the best result.
+ *
+ * To compile, from the lab3 directory:
+ *   gcc -O2 -Wall -DHOST -DCONTROLLER='"posfixed.c"' -I. \
+ *       -o gainsweep host/gainsweep.c -lm
+ *
+ * To run (all arguments optional):
+ *   ./gainsweep [-n random candidates, default 20000] [-g grid points
+ *               per parameter, instead of -n] [-s seed] [-j workers,
+ *               default all cores] [-e plant spread, default 0.2]
+ *               [-r reference step, default 200] [-d load disturbance]
+ *               [-t run time in s, default 5] [-o overshoot limit in
+ *               percent, default 5] [-k candidates listed, default 10]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SATCOUNT                    /* overflow counts, satcount.h */
+#define GS_PLANTS 9                 /* nominal and the corners of the box */
+#define AXES GS_PLANTS
+
+#ifndef CONTROLLER
+#error "Compile with -DCONTROLLER='\"<controller>.c\"'"
+#endif
+
+#include CONTROLLER
+#undef main
+
+#ifndef PARAMS_H
+#error "gainsweep needs a controller with its coefficients in RAM, posfixed.c or velfixed.c"
+#endif
+
+/* The controller's coefficient macros are not needed past its code,
+   and the design below names fields that way. Its integral may be
+   called I, so complex.h only comes after it. */
+#undef k1
+#undef k2
+#undef kr
+#undef l1
+#undef l2
+#undef lv
+#undef phi11
+#undef phi21
+#undef gamma1
+#undef gamma2
+
+#include "plant.h"
+#include "design.h"
+
+#define GS_BLOCK 64                 /* candidates taken at a time */
+#define GS_BAND  0.02               /* settling band, relative to r */
+
+#if CTRL_INPUT == 1
+#define GS_PARAMS 5
+static const char *const gs_names[GS_PARAMS] = {"wc", "zc", "wo", "zo", "wv"};
+static const double gs_ranges[GS_PARAMS][2] = {
+  {2, 15}, {0.5, 1}, {4, 40}, {0.5, 1}, {4, 40}
+};
+static const int gs_log[GS_PARAMS] = {1, 0, 1, 0, 1};
+#else
+#define GS_PARAMS 3
+static const char *const gs_names[GS_PARAMS] = {"K", "Ti", "b"};
+static const double gs_ranges[GS_PARAMS][2] = {
+  {0.5, 10}, {0.05, 2}, {0, 1}
+};
+static const int gs_log[GS_PARAMS] = {1, 1, 0};
+#endif
+
+typedef struct {
+  float settle;                     /* s, INFINITY if not settled */
+  float overshoot;                  /* percent of r */
+  uint32_t saturated, overflow;
+  int fits;                         /* coefficients fit their formats */
+} gs_result_t;
+
+typedef struct {
+  long next;                        /* next candidate to take */
+  gs_result_t result[];
+} gs_shared_t;
+
+/* The plants, one per axis, as a struct of arrays */
+static double gs_x1[GS_PLANTS], gs_x2[GS_PLANTS];
+static double gs_phi11[GS_PLANTS], gs_phi21[GS_PLANTS];
+static double gs_gamma1[GS_PLANTS], gs_gamma2[GS_PLANTS];
+
+static plant_t gs_nominal;          /* the model the design uses */
+static long gs_count, gs_grid;
+static uint64_t gs_seed = 1;
+static int gs_steps;
+static int16_t gs_ref = 200;
+static double gs_load;
+static double gs_overshoot_max = 5;
+static gs_shared_t *gs_shared;
+
+int16_t sim_read_input(uint8_t chan) {
+  return plant_adc(chan & 1 ? gs_x2[chan >> 1] : gs_x1[chan >> 1], ADC_FRAC_BITS);
+}
+
+void sim_write_output(uint8_t axis, int16_t val) {
+}
+
+/**
+ * Advance all plants one sample period with the inputs u
+ */
+static void gs_plant_step(const double u[GS_PLANTS]) {
+  int a;
+  for (a = 0; a < GS_PLANTS; a++) {
+    double x1 = gs_x1[a];
+    gs_x1[a] = gs_phi11[a] * x1 + gs_gamma1[a] * u[a];
+    gs_x2[a] += gs_phi21[a] * x1 + gs_gamma2[a] * u[a];
+  }
+}
+
+/**
+ * Plant a is the nominal model for a = 0, otherwise the corner a - 1
+ * of the box of +-e around it
+ */
+static void gs_plants_init(double e) {
+  int a;
+  for (a = 0; a < GS_PLANTS; a++) {
+    int k = a - 1;
+    double fa = a ? (k & 1 ? 1 + e : 1 - e) : 1;
+    double fb = a ? (k & 2 ? 1 + e : 1 - e) : 1;
+    double fc = a ? (k & 4 ? 1 + e : 1 - e) : 1;
+    plant_t p;
+    plant_init_model(&p, SAMPLE_H, PLANT_A * fa, PLANT_B * fb, PLANT_C * fc);
+    gs_phi11[a] = p.phi11;
+    gs_phi21[a] = p.phi21;
+    gs_gamma1[a] = p.gamma1;
+    gs_gamma2[a] = p.gamma2;
+  }
+  plant_init(&gs_nominal, SAMPLE_H);
+}
+
+/**
+ * splitmix64, a well-mixed function of the index, so that every worker
+ * can make any candidate
+ */
+static uint64_t gs_mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15u;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+  return x ^ (x >> 31);
+}
+
+#if CTRL_INPUT == 1
+/**
+ * Poles for the complex pair of natural frequency w and damping z
+ */
+static double complex gs_pair(double w, double z) {
+  return -z * w + I * w * sqrt(fmax(0, 1 - z * z));
+}
+#endif
+
+/**
+ * The design parameters of candidate i
+ */
+static void gs_candidate(long i, double p[GS_PARAMS]) {
+  int j;
+
+  if (i == 0) {                     /* the current design */
+#if CTRL_INPUT == 1
+    double complex sc = clog(POLE_C) / DESIGN_H, so = clog(POLE_O) / DESIGN_H;
+    p[0] = cabs(sc);
+    p[1] = -creal(sc) / cabs(sc);
+    p[2] = cabs(so);
+    p[3] = -creal(so) / cabs(so);
+    p[4] = -log(POLE_V) / DESIGN_H;
+#else
+    p[0] = PI_K;
+    p[1] = PI_TI;
+    p[2] = PI_B;
+#endif
+    return;
+  }
+  for (j = 0; j < GS_PARAMS; j++) {
+    double lo = gs_ranges[j][0], hi = gs_ranges[j][1], f;
+    if (gs_grid) {
+      long n = i - 1, k;
+      for (k = 0; k < j; k++) n /= gs_grid;
+      f = gs_grid > 1 ? (double) (n % gs_grid) / (gs_grid - 1) : 0.5;
+    } else {
+      f = (gs_mix(gs_seed * 0x100000001b3u + i * GS_PARAMS + j) >> 11) * (1.0 / (1ull << 53));
+    }
+    p[j] = gs_log[j] ? lo * pow(hi / lo, f) : lo + (hi - lo) * f;
+  }
+}
+
+/**
+ * x in format q, 0 if it does not fit an int16_t
+ */
+static int gs_fix(double x, int q, int16_t *to) {
+  double v = nearbyint(ldexp(x, q));
+  if (v > INT16_MAX || v < INT16_MIN) return 0;
+  *to = (int16_t) v;
+  return 1;
+}
+
+/**
+ * The coefficients of design p in the active parameter bank
+ */
+static int gs_coeffs(const double p[GS_PARAMS], int16_t *P) {
+  int ok = 1;
+#if CTRL_INPUT == 1
+  coeffs_t c;
+  coeff_design(&gs_nominal, cexp(gs_pair(p[0], p[1]) * SAMPLE_H),
+               cexp(gs_pair(p[2], p[3]) * SAMPLE_H), exp(-p[4] * SAMPLE_H), &c);
+  ok &= gs_fix(c.k1, K1_Q, &P[P_K1]);
+  ok &= gs_fix(c.k2, K2_Q, &P[P_K2]);
+  ok &= gs_fix(c.kr, KR_Q, &P[P_KR]);
+  ok &= gs_fix(c.l1, L1_Q, &P[P_L1]);
+  ok &= gs_fix(c.l2, L2_Q, &P[P_L2]);
+  ok &= gs_fix(c.lv, LV_Q, &P[P_LV]);
+  ok &= gs_fix(c.phi11, PHI11_Q, &P[P_PHI11]);
+  ok &= gs_fix(c.phi21, PHI21_Q, &P[P_PHI21]);
+  ok &= gs_fix(c.gamma1, GAMMA1_Q, &P[P_GAMMA1]);
+  ok &= gs_fix(c.gamma2, GAMMA2_Q, &P[P_GAMMA2]);
+#else
+  ok &= gs_fix(p[0], PI_K_Q, &P[P_K]);
+  ok &= gs_fix(p[0] * p[2], PI_KB_Q, &P[P_KB]);
+  ok &= gs_fix(p[0] * SAMPLE_H / p[1], KH_TI_Q, &P[P_KH_TI]);
+  ok &= gs_fix(SAMPLE_H / PI_TR, H_TR_Q, &P[P_H_TR]);
+#endif
+  return ok;
+}
+
+/**
+ * Step response of candidate i on all plants at once
+ */
+static gs_result_t gs_run(long i) {
+  double p[GS_PARAMS], u[GS_PLANTS], ymax[GS_PLANTS];
+  int last_out[GS_PLANTS];          /* last step outside the band */
+  double band = GS_BAND * gs_ref;
+  gs_result_t res = {0};
+  int a, k;
+
+  gs_candidate(i, p);
+  res.fits = gs_coeffs(p, (int16_t *) param_active);
+  if (!res.fits) return res;
+
+  memset(sat_count, 0, sizeof sat_count);
+  for (a = 0; a < GS_PLANTS; a++) {
+    ctrl_reset(a);
+    gs_x1[a] = gs_x2[a] = 0;
+    ymax[a] = 0;
+    last_out[a] = -1;
+  }
+  for (k = 0; k < gs_steps; k++) {
+    for (a = 0; a < GS_PLANTS; a++) {
+      double y = CTRL_INPUT ? gs_x2[a] : gs_x1[a];
+      int16_t yq = plant_adc(y, ADC_FRAC_BITS);
+      int16_t v;
+
+      v = ctrl_output(a, yq, gs_ref);
+      ctrl_update(a, yq, gs_ref, v);
+      u[a] = v + gs_load;
+      res.saturated += v == 511 || v == -512;
+      if (fabs(y - gs_ref) > band) last_out[a] = k;
+      if (y > ymax[a]) ymax[a] = y;
+    }
+    gs_plant_step(u);
+  }
+
+  for (a = 0; a < GS_PLANTS; a++) {
+    double settle = last_out[a] + 1 < gs_steps ? (last_out[a] + 1) * SAMPLE_H : INFINITY;
+    double over = 100 * (ymax[a] - gs_ref) / gs_ref;
+    if (settle > res.settle) res.settle = settle;
+    if (over > res.overshoot) res.overshoot = over;
+  }
+  for (k = 0; k < SAT_SITES; k++) res.overflow += sat_count[k];
+  return res;
+}
+
+/**
+ * Take blocks of candidates until none are left
+ */
+static void gs_worker(void) {
+  long i, end;
+  while ((i = __atomic_fetch_add(&gs_shared->next, GS_BLOCK, __ATOMIC_RELAXED)) < gs_count) {
+    end = i + GS_BLOCK < gs_count ? i + GS_BLOCK : gs_count;
+    for (; i < end; i++) gs_shared->result[i] = gs_run(i);
+  }
+}
+
+/**
+ * Ranking order of two candidates, better first
+ */
+static int gs_compare(const void *pa, const void *pb) {
+  long ia = *(const long *) pa, ib = *(const long *) pb;
+  const gs_result_t *a = &gs_shared->result[ia], *b = &gs_shared->result[ib];
+  int ka[3] = {a->overflow != 0, isinf(a->settle), a->overshoot > gs_overshoot_max};
+  int kb[3] = {b->overflow != 0, isinf(b->settle), b->overshoot > gs_overshoot_max};
+  int j;
+
+  for (j = 0; j < 3; j++)
+    if (ka[j] != kb[j]) return ka[j] - kb[j];
+  if (a->settle != b->settle) return a->settle < b->settle ? -1 : 1;
+  if (a->saturated != b->saturated) return a->saturated < b->saturated ? -1 : 1;
+  return ia < ib ? -1 : ia > ib;
+}
+
+static void gs_print_row(long rank, long i) {
+  const gs_result_t *r = &gs_shared->result[i];
+  double p[GS_PARAMS];
+  int j;
+
+  gs_candidate(i, p);
+  printf(" * %5ld %9ld %9.2f %9.1f %9u %9u ", rank, i, r->settle, r->overshoot,
+         r->saturated, r->overflow);
+  for (j = 0; j < GS_PARAMS; j++) printf(" %7.3f", p[j]);
+  printf("%s\n", i == 0 ? "  (current)" : "");
+}
+
+static double gs_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-n candidates | -g grid points] [-s seed] [-j workers]\n"
+          "  [-e spread] [-r step] [-d disturbance] [-t seconds] [-o overshoot %%] [-k listed]\n",
+          name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  long n = 20000, *order, fitting = 0, rank0 = 0, i;
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  double spread = 0.2, seconds = 5, t0, t1, p[GS_PARAMS];
+  int listed = 10, opt, j;
+
+  while ((opt = getopt(argc, argv, "n:g:s:j:e:r:d:t:o:k:")) != -1) {
+    switch (opt) {
+    case 'n': n = atol(optarg); break;
+    case 'g': gs_grid = atol(optarg); break;
+    case 's': gs_seed = strtoull(optarg, NULL, 0); break;
+    case 'j': jobs = atol(optarg); break;
+    case 'e': spread = atof(optarg); break;
+    case 'r': gs_ref = atoi(optarg); break;
+    case 'd': gs_load = atof(optarg); break;
+    case 't': seconds = atof(optarg); break;
+    case 'o': gs_overshoot_max = atof(optarg); break;
+    case 'k': listed = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind != argc || n < 1 || gs_grid < 0 || gs_ref <= 0 || seconds <= 0
+      || spread < 0 || spread >= 1)
+    usage(argv[0]);
+  if (jobs < 1) jobs = 1;
+  if (gs_grid) {
+    for (n = 1, j = 0; j < GS_PARAMS; j++) n *= gs_grid;
+  }
+  gs_count = n + 1;                 /* and the current design */
+  gs_steps = (int) (seconds / SAMPLE_H + 0.5);
+
+  gs_shared = mmap(NULL, sizeof *gs_shared + gs_count * sizeof gs_shared->result[0],
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  order = malloc(gs_count * sizeof *order);
+  if (gs_shared == MAP_FAILED || !order) {
+    perror("gainsweep");
+    return 1;
+  }
+  gs_plants_init(spread);
+  ctrl_init();
+
+  t0 = gs_now();
+  fflush(stdout);
+  for (i = 0; i < jobs; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      gs_worker();
+      _exit(0);
+    }
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+  }
+  while (wait(NULL) > 0) {}
+  t1 = gs_now();
+  fprintf(stderr, "%ld candidates on %d plants, %ld workers: %.2f s\n",
+          gs_count, GS_PLANTS, jobs, t1 - t0);
+
+  for (i = 0; i < gs_count; i++)
+    if (gs_shared->result[i].fits) order[fitting++] = i;
+  if (fitting == 0) {
+    fprintf(stderr, "no candidate fits the coefficient formats\n");
+    return 1;
+  }
+  qsort(order, fitting, sizeof *order, gs_compare);
+  for (i = 0; i < fitting; i++)
+    if (order[i] == 0) rank0 = i + 1;
+
+  printf("/**\n"
+         " * %s design found by host/gainsweep.c for %s at %d ms:\n"
+         " * %ld candidates, %ld dropped as not fitting the coefficient formats;\n"
+         " * step of %d with load disturbance %g, %g s, on %d plants with a, b and c\n"
+         " * within +-%g%%, overshoot limit %g%%.\n"
+         " *\n"
+         " *  rank candidate  settle s overshoot saturated  overflow ",
+         CTRL_INPUT == 1 ? "Position controller" : "Velocity PI", CONTROLLER, SAMPLE_MS,
+         gs_count, gs_count - fitting, gs_ref, gs_load, seconds, GS_PLANTS,
+         100 * spread, gs_overshoot_max);
+  for (j = 0; j < GS_PARAMS; j++) printf(" %7s", gs_names[j]);
+  printf("\n");
+  for (i = 0; i < fitting && i < listed; i++) gs_print_row(i + 1, order[i]);
+  if (rank0 > listed) gs_print_row(rank0, 0);
+  printf(" *\n"
+         " * Scored on point samples of the plants, without the averaging and delay\n"
+         " * of the AD windows (adc.h); check the design in host/servosim.c, which\n"
+         " * models them, before flashing it.\n"
+         " */\n\n");
+
+  gs_candidate(order[0], p);
+#if CTRL_INPUT == 1
+  {
+    double complex zc = cexp(gs_pair(p[0], p[1]) * DESIGN_H);
+    double complex zo = cexp(gs_pair(p[2], p[3]) * DESIGN_H);
+    printf("#define POLE_C     (%.9f + %.9f * I)\n", creal(zc), cimag(zc));
+    printf("#define POLE_O     (%.9f + %.9f * I)\n", creal(zo), cimag(zo));
+    printf("#define POLE_V     %.9f\n", exp(-p[4] * DESIGN_H));
+  }
+#else
+  printf("#define PI_K       %.9f\n", p[0]);
+  printf("#define PI_TI      %.9f\n", p[1]);
+  printf("#define PI_B       %.9f\n", p[2]);
+#endif
+  printf("#define COEFF_HEADROOM %d\n", COEFF_HEADROOM);
+  return 0;
+}
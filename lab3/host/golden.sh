@@ -0,0 +1,121 @@
+#!/bin/sh
+#
+# Golden-trace regression test of the controllers.
+#
+# Every controller is run open loop in servosim for 200000 control
+# steps on two input sequences
+#   synthetic  servosim -g 1, the same sequence on every host, and
+#   recorded   the AD input of a closed-loop run of the controller,
+#              host/golden/<controller>.<SAMPLE_MS>.input.gz,
+# with the reference flips of servosim and a stop and restart before
+# each flip (-o), so that all modes are gone through. The -s trace of
+# each run, Y, r, u and the states of every control step, must match
+# the golden one:
+#   fixed point     bit-exact: the digest of the trace must be the one
+#                   in host/golden.txt;
+#   floating point  within FLOAT_TOL (default 0.5, in input units) of
+#                   every 200th record, which is what is kept in
+#                   host/golden/<controller>.<SAMPLE_MS>.<input>, since
+#                   the last bits depend on the compiler and libm.
+#
+# All of it is in git, so the test passes on a fresh checkout. With -u
+# the controllers as they are now are taken as golden: the digests in
+# host/golden.txt and the floating-point traces are replaced, so a
+# change that is meant to change the outputs is committed together
+# with them. The recorded inputs stay as they are, so that a changed
+# controller is still run on the same input; a missing one is
+# recorded, so delete it to record it again.
+#
+# To run, from the lab3 directory:
+#   sh host/golden.sh [-u]
+
+set -e
+
+update=0
+if [ "$1" = -u ]; then
+  update=1
+fi
+steps=200000
+every=200
+float_tol=${FLOAT_TOL:-0.5}
+golden=host/golden
+digests=host/golden.txt
+tmp=${TMPDIR:-/tmp}/golden.$$
+mkdir -p "$tmp"
+trap 'rm -rf "$tmp"' EXIT
+fail=0
+
+gcc -O2 -Wall -o "$tmp/tracecmp" host/tracecmp.c -lm
+
+# check <what> <trace> <golden trace> <tolerance>
+check() {
+  if [ ! -f "$3" ]; then
+    echo "  $1: no golden trace, run with -u"
+    fail=1
+  elif "$tmp/tracecmp" -t "$4" "$3" "$2" > "$tmp/cmp"; then
+    echo "  $1: $(tail -n 1 "$tmp/cmp")"
+  else
+    echo "  $1: FAILED"
+    sed 's/^/    /' "$tmp/cmp"
+    fail=1
+  fi
+}
+
+while read -r c ms kind; do
+  gcc -O2 -Wall -DHOST -DSAMPLE_MS="$ms" -DCONTROLLER="\"$c.c\"" -I. \
+      -o "$tmp/$c" host/servosim.c -lm
+  echo "== $c.c, $steps steps of $ms ms"
+
+  input="$golden/$c.$ms.input.gz"
+  if [ $update = 1 ] && [ ! -f "$input" ]; then
+    "$tmp/$c" -n "$steps" -o 20 -w "$tmp/input" > /dev/null
+    gzip -9 -n -c "$tmp/input" > "$input"
+    echo "  recorded: input saved"
+  fi
+
+  for run in synthetic recorded; do
+    if [ $run = synthetic ]; then
+      digest=$("$tmp/$c" -n "$steps" -o 20 -g 1 -e $every -s "$tmp/trace" | sed -n 's/^digest *//p')
+    elif [ -f "$input" ]; then
+      gzip -dc "$input" > "$tmp/input"
+      digest=$("$tmp/$c" -n "$steps" -o 20 -i "$tmp/input" -e $every -s "$tmp/trace" | sed -n 's/^digest *//p')
+    else
+      echo "  $run: no recorded input, run with -u"
+      fail=1
+      continue
+    fi
+    key="$c $ms $run"
+
+    if [ $update = 1 ]; then
+      if [ "$kind" = fixed ]; then
+        { grep -v "^$key " "$digests" || true; echo "$key $digest"; } > "$tmp/digests"
+        cp "$tmp/digests" "$digests"
+        echo "  $run: saved, digest $digest"
+      else
+        cp "$tmp/trace" "$golden/$c.$ms.$run"
+        echo "  $run: saved"
+      fi
+    elif [ "$kind" = fixed ]; then
+      expect=$(sed -n "s/^$key //p" "$digests")
+      if [ -z "$expect" ]; then
+        echo "  $run: no digest in $digests, run with -u"
+        fail=1
+      elif [ "$expect" = "$digest" ]; then
+        echo "  $run: digest $digest, as in $digests"
+      else
+        echo "  $run: FAILED, digest $digest instead of $expect"
+        fail=1
+      fi
+    else
+      check $run "$tmp/trace" "$golden/$c.$ms.$run" "$float_tol"
+    fi
+  done
+done <<LIST
+posfixed 50 fixed
+velfixed 50 fixed
+cascfixed 10 fixed
+posfloat 50 float
+velfloat 50 float
+LIST
+
+exit $fail
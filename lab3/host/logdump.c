@@ -0,0 +1,105 @@
+/**
+ * Print the dumps of the ring-buffer logger (logger.h) as a table.
+ *
+ * Reads a capture of the serial line, or a servosim -l file, and picks
+ * out the logger frames, refproto.h frames with command LOG_CMD_RECORD;
+ * frames of other commands are skipped by their length, and text
+ * replies in between, and frames with a bad checksum, byte by byte. Every dump starts
+ * with a line naming what triggered it, followed by one line per
+ * control sample:
+ *   t  tick  Y  r  u  s0
+ * with t the sample relative to the trigger (t = 0 is the sample that
+ * triggered) and s0 the first telemetry state, in input units.
+ *
+ * To compile, from the lab3 directory:
+ *   gcc -O2 -Wall -I. -o logdump host/logdump.c
+ *
+ * To run:
+ *   ./logdump [capture file, default standard input]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "refproto.h"
+
+#define LOG_PAYLOAD 12
+#define LOG_FRAME   (4 + LOG_PAYLOAD + 1)
+
+static int16_t log_word(const uint8_t *p) {
+  return (int16_t) (p[0] | p[1] << 8);
+}
+
+/**
+ * Read all of f
+ */
+static uint8_t *log_read(FILE *f, size_t *n) {
+  size_t size = 4096, got;
+  uint8_t *buf = malloc(size);
+
+  *n = 0;
+  while (buf && (got = fread(buf + *n, 1, size - *n, f)) > 0) {
+    *n += got;
+    if (*n == size) buf = realloc(buf, size *= 2);
+  }
+  if (!buf) {
+    fprintf(stderr, "out of memory\n");
+    exit(1);
+  }
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  FILE *f = stdin;
+  uint8_t *buf;
+  size_t n, i, j;
+  long frames = 0, dumps = 0;
+  int last_t = 127;
+
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [capture file]\n", argv[0]);
+    return 2;
+  }
+  if (argc == 2 && !(f = fopen(argv[1], "rb"))) {
+    perror(argv[1]);
+    return 1;
+  }
+  buf = log_read(f, &n);
+  if (f != stdin) fclose(f);
+
+  for (i = 0; i + 4 <= n; i++) {
+    const uint8_t *p = buf + i;
+    size_t len = 4 + p[3] + 1;
+    uint8_t sum = 0;
+    int t;
+
+    if (p[0] != REF_SYNC0 || p[1] != REF_SYNC1 || i + len > n) continue;
+    for (j = 2; j < len - 1; j++) sum += p[j];
+    if (sum != p[len - 1]) continue;
+    if (p[2] != LOG_CMD_RECORD || p[3] != LOG_PAYLOAD) {
+      i += len - 1;                 /* another command's frame */
+      continue;
+    }
+    p += 4;
+
+    t = (int8_t) p[0];
+    if (t <= last_t) {
+      printf("%sdump %ld, trigger%s%s%s\n", dumps ? "\n" : "", dumps,
+             p[1] & 0x01 ? " reference" : "", p[1] & 0x02 ? " saturation" : "",
+             p[1] & 0x04 ? " command" : "");
+      printf("     t   tick      Y      r      u     s0\n");
+      dumps++;
+    }
+    printf("%6d %6u %6d %6d %6d %6d\n", t, (uint16_t) log_word(p + 2),
+           log_word(p + 4), log_word(p + 6), log_word(p + 8), log_word(p + 10));
+    last_t = t;
+    frames++;
+    i += LOG_FRAME - 1;
+  }
+  free(buf);
+  if (frames == 0) {
+    fprintf(stderr, "no logger frames\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * Discrete-time model of the rotating DC servo for host simulation.
+ *
+ * Continuous model from the lab manual, in AD/PWM units:
+ *   dx1/dt = -a x1 + b (u + d)     x1 = angular velocity (channel 0)
+ *   dx2/dt =  c x1                 x2 = angular position (channel 1)
+ * with a = 0.12, b = 2.25, c = 5 and d a constant load disturbance.
+ * plant_init() samples it with zero-order hold at the given period;
+ * at h = 0.05 this gives the phi/gamma used in posfloat.c.
+ * plant_init_model() does the same for other parameters.
+ *
+ * PLANT_A, PLANT_B and PLANT_C can be replaced by the values fitted to
+ * the real servo by host/sysid.c, e.g. with gcc -include plant_id.h.
+ */
+
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <inttypes.h>
+#include <math.h>
+
+#ifndef PLANT_A
+#define PLANT_A 0.12
+#define PLANT_B 2.25
+#define PLANT_C 5.0
+#endif
+
+typedef struct {
+  double x1, x2;                    /* velocity, position */
+  double phi11, phi21, gamma1, gamma2;
+  double d;                         /* input load disturbance */
+} plant_t;
+
+/**
+ * Sample the model with parameters a, b and c at period h
+ */
+static void plant_init_model(plant_t *p, double h, double a, double b, double c) {
+  double e = exp(-a * h);
+  double f = (1 - e) / a;           /* integral of exp(-a s) over [0, h] */
+
+  p->x1 = p->x2 = p->d = 0;
+  p->phi11 = e;
+  p->phi21 = c * f;
+  p->gamma1 = b * f;
+  p->gamma2 = c * b * (h - f) / a;
+}
+
+static void plant_init(plant_t *p, double h) {
+  plant_init_model(p, h, PLANT_A, PLANT_B, PLANT_C);
+}
+
+/**
+ * Advance one period with the input held at u
+ */
+static inline void plant_step(plant_t *p, double u) {
+  double x1 = p->x1;
+  u += p->d;
+  p->x1 = p->phi11 * x1 + p->gamma1 * u;
+  p->x2 = p->x2 + p->phi21 * x1 + p->gamma2 * u;
+}
+
+/**
+ * Quantize a signal the way the 10-bit AD converter does, with frac
+ * extra fractional bits from oversampling
+ */
+static inline int16_t plant_adc(double x, int frac) {
+  double lsb = 1 << frac;
+  if (x >= 511) return 511 * lsb;
+  if (x <= -512) return -512 * lsb;
+  return (int16_t) lrint(x * lsb);
+}
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * Generator for the binary command frames of reference.h and params.h.
+ *
+ * Writes the frames for one command to standard output, to be sent to
+ * the controller over the serial line or given to servosim with -c.
+ * A profile is sampled at the given number of points, loaded with
+ * LOAD frames of 8 points and started with a PLAY frame.
+ *
+ * To compile, from the lab3 directory:
+ *   gcc -O2 -Wall -I. -o refgen host/refgen.c -lm
+ *
+ * To run:
+ *   ./refgen [-n points] [-s shift] [-l] [-q bits] <command>
+ * with one of the commands
+ *   set <value>                    set the reference
+ *   stop                           stop playback
+ *   ramp <from> <to>               straight line
+ *   scurve <from> <to>             smoothstep, zero slope at both ends
+ *   sine <amplitude> <c0> <c1>     sine sweeping from c0 to c1 cycles
+ *                                  per profile
+ *   param <index> <value>...       write coefficients into the shadow
+ *                                  bank, up to 8
+ *   commit                         make the shadow bank active
+ *   read <index> <count>           ask for coefficients
+ *   save                           store the active bank in EEPROM
+ *   defaults                       compiled-in values into the shadow bank
+ * Each point lasts 2^shift control samples (-s, 0..7) and -l loops the
+ * profile. Coefficient values are real numbers scaled by 2^bits (-q,
+ * default 13), so the gains can be written as in the design; the
+ * indices are the P_ enum of the controller. In posfixed.c and
+ * velfixed.c every coefficient has its own format, <NAME>_Q in coeffs.h
+ * for the sample period, and -q has to match it. For example, a 20 s
+ * sine sweep at 50 ms sampling, and a new velocity PI gain K (PI_K_Q 12)
+ * and K*b (PI_KB_Q 13):
+ *   ./refgen -n 50 -s 3 sine 200 1 8 > /dev/ttyS0
+ *   (./refgen -q 12 param 0 3.0; ./refgen param 1 1.5; ./refgen commit) > /dev/ttyS0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "refproto.h"
+
+static void gen_frame(uint8_t cmd, const uint8_t *p, uint8_t len) {
+  uint8_t sum = cmd + len;
+  uint8_t i;
+
+  putchar(REF_SYNC0);
+  putchar(REF_SYNC1);
+  putchar(cmd);
+  putchar(len);
+  for (i = 0; i < len; i++) {
+    putchar(p[i]);
+    sum += p[i];
+  }
+  putchar(sum);
+}
+
+static uint8_t gen_word(uint8_t *p, double x) {
+  int16_t w = (int16_t) lrint(fmax(-512, fmin(511, x)));  /* ref_clamp()'s limits, before narrowing */
+  p[0] = (uint8_t) w;
+  p[1] = (uint8_t) ((uint16_t) w >> 8);
+  return 2;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-n points] [-s shift] [-l] [-q bits] set <value> | stop |\n"
+          "  ramp <from> <to> | scurve <from> <to> | sine <amplitude> <c0> <c1> |\n"
+          "  param <index> <value>... | commit | read <index> <count> | save | defaults\n",
+          name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int n = REF_POINTS, shift = 0, loop = 0, q = 13, opt, i;
+  double a = 0, b = 0, c = 0;
+  const char *cmd;
+  uint8_t p[REF_PAYLOAD] = {0};
+
+  while ((opt = getopt(argc, argv, "+n:s:lq:")) != -1) {
+    switch (opt) {
+    case 'n': n = atoi(optarg); break;
+    case 's': shift = atoi(optarg); break;
+    case 'l': loop = 1; break;
+    case 'q': q = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc || n < 2 || n > REF_POINTS || shift < 0 || shift > 7) usage(argv[0]);
+  cmd = argv[optind++];
+  if (optind < argc) a = atof(argv[optind]);
+  if (optind + 1 < argc) b = atof(argv[optind + 1]);
+  if (optind + 2 < argc) c = atof(argv[optind + 2]);
+
+  if (!strcmp(cmd, "set")) {
+    gen_frame(REF_CMD_SET, p, gen_word(p, a));
+    return 0;
+  }
+  if (!strcmp(cmd, "stop")) {
+    gen_frame(REF_CMD_STOP, p, 0);
+    return 0;
+  }
+  if (!strcmp(cmd, "param")) {
+    uint8_t len = 1;
+    if (optind + 1 >= argc || argc - optind > 9) usage(argv[0]);
+    p[0] = atoi(argv[optind]);
+    for (i = optind + 1; i < argc; i++) {
+      long w = lrint(ldexp(atof(argv[i]), q));
+      if (w > INT16_MAX || w < INT16_MIN) {
+        fprintf(stderr, "%s does not fit in Q%d\n", argv[i], q);
+        return 1;
+      }
+      p[len++] = (uint8_t) w;
+      p[len++] = (uint8_t) ((uint16_t) w >> 8);
+    }
+    gen_frame(PARAM_CMD_WRITE, p, len);
+    return 0;
+  }
+  if (!strcmp(cmd, "read")) {
+    p[0] = (uint8_t) a;
+    p[1] = (uint8_t) b;
+    gen_frame(PARAM_CMD_READ, p, 2);
+    return 0;
+  }
+  if (!strcmp(cmd, "commit") || !strcmp(cmd, "save") || !strcmp(cmd, "defaults")) {
+    gen_frame(cmd[0] == 'c' ? PARAM_CMD_COMMIT :
+              cmd[0] == 's' ? PARAM_CMD_SAVE : PARAM_CMD_DEFAULTS, p, 0);
+    return 0;
+  }
+  if (strcmp(cmd, "ramp") && strcmp(cmd, "scurve") && strcmp(cmd, "sine")) usage(argv[0]);
+
+  for (i = 0; i < n; i += 8) {
+    uint8_t len = 1;
+    int j;
+    p[0] = i;
+    for (j = i; j < n && j < i + 8; j++) {
+      double t = (double) j / (loop ? n : n - 1);     /* 0..1 over the profile */
+      double x;
+      if (cmd[1] == 'a') x = a + (b - a) * t;
+      else if (cmd[1] == 'c') x = a + (b - a) * t * t * (3 - 2 * t);
+      else x = a * sin(2 * M_PI * (b * t + (c - b) * t * t / 2));
+      len += gen_word(p + len, x);
+    }
+    gen_frame(REF_CMD_LOAD, p, len);
+  }
+  p[0] = n;
+  p[1] = shift;
+  p[2] = loop ? REF_LOOP : 0;
+  gen_frame(REF_CMD_PLAY, p, 3);
+  return 0;
+}
@@ -0,0 +1,482 @@
+/**
+ * Closed-loop host simulator and benchmark for the DC-servo controllers.
+ *
+ * One of the controller programs is compiled natively against the
+ * -DHOST hardware access layer (hal.h) and run against the DC-servo
+ * model in plant.h. The harness calls ISR(TIMER2_COMP_vect) every
+ * simulated timer tick (SAMPLE_TICK, sampling.h; build with
+ * -DSAMPLE_MS=<ms> for other sample periods), advances the plant
+ * between ticks, and sends
+ * 's' and 'r' through ISR(USART_RXC_vect) the same way simcom would.
+ * After every tick it runs the background tasks of main() (tasks.h)
+ * that send telemetry frames and save the coefficients. The reports
+ * and the logger dump wait for room in the transmit queue, which the
+ * harness only drains between ticks, so they are left out; -l writes
+ * the logger dumps to a file instead.
+ *
+ * To compile, from the lab3 directory, e.g. for posfixed.c:
+ *   gcc -O2 -Wall -DHOST -DCONTROLLER='"posfixed.c"' -I. \
+ *       -o servosim host/servosim.c -lm
+ *
+ * To run (all arguments optional):
+ *   ./servosim [-n control steps] [-p steps between reference flips,
+ *              default 10 s, 0 for none] [-r reference amplitude,
+ *              default 255] [-d load disturbance] [-t telemetry output
+ *              file] [-c command file] [-o steps off before each flip]
+ *              [-s state trace file] [-e trace every e-th step]
+ *              [-w input record file] [-i input replay file]
+ *              [-g synthetic input seed] [-l logger dump file]
+ *              [-a point sampling, no AD model]
+ *
+ * To compare the controllers:
+ *   for c in posfixed posfloat velfixed velfloat cascfixed; do
+ *     gcc -O2 -DHOST -DCONTROLLER="\"$c.c\"" -I. -o servosim host/servosim.c -lm
+ *     ./servosim
+ *   done
+ *
+ * Prints the RMS and maximum tracking error r - y over all control
+ * steps, the number of steps with the output at the +511/-512 limit,
+ * and two times per control step:
+ *   ns/step      the control law alone: after the run, ctrl_output()
+ *                and ctrl_update() of axis 0 are timed for as many
+ *                steps on the last SIM_BENCH inputs the controller
+ *                read, which is what tells the controllers apart;
+ *   run ns/step  the whole simulation, with the plant, the AD model
+ *                and the serial line, most of it the AD model.
+ * Measured with gcc -O2 on one core of a Xeon host, 200000 steps of
+ * 50 ms (cascfixed at 10 ms), best of three:
+ *   posfloat 15.8  posfixed 17.7  velfloat 14.5  velfixed 7.9
+ *   cascfixed 9.8 ns/step
+ * i.e. 55 to 125 million control steps per second. The AD model runs
+ * at about 2 us per step, with -a about 40 ns.
+ * The controller reads the plant through the AD pipeline of adc.h:
+ * between ticks the harness runs ISR(ADC_vect) once per conversion
+ * time, ADC_CONV_NS, with the plant outputs interpolated to that
+ * instant and quantized to 10 bits, so the inputs carry the delay of
+ * the round robin and of the oversampling as on the board. With -a the
+ * controller reads the plant outputs at the sample instant instead,
+ * quantized to ADC_FRAC_BITS fractional bits, which is the model the
+ * controllers were designed for and some fifty times faster to run.
+ * The transmit queue is drained through ISR(USART_UDRE_vect) at the
+ * 3840 bytes/s of 38400 baud. With -t the controller's binary
+ * telemetry is switched on with 'b' and everything the USART sends is
+ * written to the file. With -c the bytes of the file, e.g. reference
+ * frames from host/refgen.c, are received after the start command,
+ * and the reference is not flipped unless -p is also given:
+ *   ./refgen -s 2 scurve -200 200 > scurve.bin && ./servosim -c scurve.bin
+ *
+ * With -o the controller is stopped with 't' for the given number of
+ * control periods before each reference flip and started again with
+ * 's' after it, to measure restart transients (see mode.h).
+ *
+ * With -s the harness writes, for every control step, the record
+ *   Y, r, u, s0, s1, s2, s3
+ * as seven floats in host byte order: the telemetry values, with the
+ * states in input units from ctrl_states() (controller.h) at full
+ * precision. With -w it writes every value the controller reads from
+ * the AD converter as an int16_t, and with -i it feeds the values
+ * from such a file to the controller instead of the plant output, so
+ * that two controllers can be run on exactly the same input sequence
+ * (open loop). The run ends when the file does. host/fixbench.sh uses
+ * this to compare the fixed-point and floating-point controllers,
+ * with host/tracecmp.c.
+ *
+ * With -g the controller reads a synthetic input instead, also open
+ * loop: every AD channel holds a random level for up to 128 reads,
+ * moves an eighth of the way to the next level per read and carries
+ * up to +-2 LSB of noise, over the whole AD range. The sequence is
+ * made with integer arithmetic from the seed alone, so it is the same
+ * on every host. With -i, -g or -s the harness prints a 64-bit digest
+ * (FNV-1a) of the -s records, with the states at the full precision of
+ * ctrl_states(), which pins the exact output and state sequence of a
+ * fixed-point controller; host/golden.sh checks the
+ * controllers against stored digests and traces this way. With -e
+ * only every e-th record is written to the -s trace, for a compact
+ * reference; the digest still covers every step.
+ *
+ * Built with -DSATCOUNT as well, it prints for each saturation count
+ * site of a fixed-point controller (satcount.h) the number of control
+ * steps in which that term clipped, separately for the positive and
+ * the negative reference, e.g. to find the reference amplitude at
+ * which the observer starts to saturate:
+ *   gcc -O2 -DHOST -DSATCOUNT -DCONTROLLER='"posfixed.c"' -I. \
+ *       -o servosim host/servosim.c -lm
+ *   for a in 100 200 300 400 500; do ./servosim -r $a; done
+ *
+ * Built with -DLOGGER, -l writes the dumps of the ring-buffer logger
+ * (logger.h) to the file. A dump is written as soon as the logger
+ * freezes, not at the line rate, and the logger is armed again with
+ * 'l', so the file has one window for every trigger:
+ *   gcc -O2 -DHOST -DLOGGER -DCONTROLLER='"posfixed.c"' -I. \
+ *       -o servosim host/servosim.c -lm
+ *   ./servosim -n 1000 -l log.bin && ./logdump log.bin
+ *
+ * Built with -DAXES=2 (hal.h), every axis drives a plant of its own
+ * and is started with 's', all with the same -r and -d. The reference
+ * flips, the commands of -c, the statistics and the -s trace are those
+ * of axis 0; -w and -i take the inputs of all axes in the order read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "plant.h"
+
+#ifndef CONTROLLER
+#error "Compile with -DCONTROLLER='\"<controller>.c\"'"
+#endif
+
+#include CONTROLLER
+#undef main
+
+#if AXES > SAMPLE_DIV
+#error "Each axis needs its own timer tick, use a longer SAMPLE_MS"
+#endif
+
+#define TICK_BYTES (3840 * SAMPLE_TICK)  /* USART bytes per tick at 38400 baud */
+
+static plant_t plant[AXES];
+static int16_t sim_u[AXES];         /* Output held by the PWM */
+static double sim_y;                /* Last value read by the controller */
+static long sim_steps, sim_saturated, sim_tx_bytes;
+static long sim_samples;            /* control steps in any mode */
+static double sim_err2, sim_err_max, sim_tx_credit;
+static double sim_adc_t;            /* next conversion, s into the tick */
+static int sim_point;               /* -a: no AD model */
+#define SIM_BENCH 4096              /* inputs kept for the control law timing */
+static int16_t sim_bench_y[SIM_BENCH];
+static unsigned sim_bench_n;
+static volatile int16_t sim_sink;   /* keeps the timed outputs */
+static FILE *sim_telemetry, *sim_trace, *sim_record, *sim_replay, *sim_log;
+static int sim_replay_end;
+static long sim_trace_every = 1, sim_trace_n;  /* -e */
+static uint32_t sim_gen;            /* -g generator state, 0 if off */
+static int16_t sim_gen_y[2 * AXES], sim_gen_level[2 * AXES];
+static uint8_t sim_gen_hold[2 * AXES];
+static uint64_t sim_digest = 0xcbf29ce484222325u;  /* FNV-1a offset basis */
+#if defined(SATCOUNT) && defined(SAT_NAMES)
+static long sim_sat[2][SAT_SITES];  /* [r < 0][site] */
+#endif
+
+/**
+ * xorshift32
+ */
+static uint32_t sim_gen_random(void) {
+  sim_gen ^= sim_gen << 13;
+  sim_gen ^= sim_gen >> 17;
+  sim_gen ^= sim_gen << 5;
+  return sim_gen;
+}
+
+/**
+ * Next -g input of a channel, [-512..511] with ADC_FRAC_BITS fractional
+ * bits
+ */
+static int16_t sim_gen_input(uint8_t chan) {
+  const int16_t max = (512 << ADC_FRAC_BITS) - 1;
+  int16_t y;
+
+  if (sim_gen_hold[chan]-- == 0) {
+    sim_gen_hold[chan] = sim_gen_random() & 127;
+    sim_gen_level[chan] = (int16_t) (sim_gen_random() % (2u * max + 2)) - max - 1;
+  }
+  sim_gen_y[chan] += (sim_gen_level[chan] - sim_gen_y[chan]) / 8;
+  y = sim_gen_y[chan] + (int16_t) (sim_gen_random() % (4u << ADC_FRAC_BITS | 1))
+      - (2 << ADC_FRAC_BITS);
+  if (y > max) y = max;
+  else if (y < -max - 1) y = -max - 1;
+  return y;
+}
+
+int16_t sim_read_input(uint8_t chan) {
+  const plant_t *p = &plant[chan >> 1];
+  int16_t y = sim_gen ? sim_gen_input(chan)
+            : sim_point ? plant_adc(chan & 1 ? p->x2 : p->x1, ADC_FRAC_BITS)
+            : adc_latest(chan);
+  if (sim_replay && fread(&y, sizeof y, 1, sim_replay) != 1) {
+    sim_replay_end = 1;
+    y = 0;
+  }
+  if (sim_record) fwrite(&y, sizeof y, 1, sim_record);
+  if (chan == AXIS_INPUT(0, CTRL_INPUT)) {
+    sim_y = y * (1.0 / (1 << ADC_FRAC_BITS));
+    sim_bench_y[sim_bench_n++ % SIM_BENCH] = y;
+  }
+  return y;
+}
+
+/**
+ * Run the AD conversions that complete during the tick in which the
+ * plants went from x1[a], x2[a] to their present states
+ */
+static void sim_adc_tick(const double *x1, const double *x2) {
+  for (; sim_adc_t < SAMPLE_TICK; sim_adc_t += ADC_CONV_NS * 1e-9) {
+    double f = sim_adc_t / SAMPLE_TICK;
+    const plant_t *p = &plant[adc_chan >> 1];
+    uint8_t a = adc_chan >> 1;
+    double x = adc_chan & 1 ? x2[a] + f * (p->x2 - x2[a]) : x1[a] + f * (p->x1 - x1[a]);
+    ADC = plant_adc(x, 0) + 512;
+    ADC_vect();
+  }
+  sim_adc_t -= SAMPLE_TICK;
+}
+
+/**
+ * Called once per control step of each axis, so it also does the
+ * bookkeeping for axis 0
+ */
+void sim_write_output(uint8_t axis, int16_t val) {
+  double e = r[0] - sim_y;
+  if (val > 511) val = 511;
+  if (val < -512) val = -512;
+  sim_u[axis] = val;
+  if (axis != 0) return;
+  sim_samples++;
+  if (mode[0] == MODE_IDENT) sim_steps++;     /* -n counts these too */
+  if (mode[0] != MODE_ON) return;
+  sim_steps++;
+  if (val == 511 || val == -512) sim_saturated++;
+  sim_err2 += e * e;
+  if (fabs(e) > sim_err_max) sim_err_max = fabs(e);
+}
+
+#if defined(SATCOUNT) && defined(SAT_NAMES)
+/**
+ * Move the counts of the last control step to sim_sat, by reference sign
+ */
+static void sim_sat_collect(void) {
+  int i;
+  for (i = 0; i < SAT_SITES; i++) {
+    sim_sat[r[0] < 0][i] += sat_count[i] != 0;
+    sat_count[i] = 0;
+  }
+}
+
+static void sim_sat_print(void) {
+  const char *names = SAT_NAMES;
+  int i, n;
+
+  printf("saturation  steps with r > 0, r < 0\n");
+  for (i = 0; i < SAT_SITES && *names; i++) {
+    while (*names == ' ') names++;
+    for (n = 0; names[n] && names[n] != ' '; n++) {}
+    printf("  %-9.*s %ld, %ld\n", n, names, sim_sat[0][i], sim_sat[1][i]);
+    names += n;
+  }
+}
+#endif
+
+#ifdef LOGGER
+static void sim_log_write(const uint8_t *p, uint8_t n) {
+  fwrite(p, 1, n, sim_log);
+}
+#endif
+
+#ifdef PROFILE
+static void sim_print(char ch) {
+  putchar(ch);
+}
+#endif
+
+/* Background tasks that never wait for the transmit queue */
+#define SIM_TASKS (TASK_TELEMETRY | TASK_PARAM_SAVE)
+
+/**
+ * Deliver a received character to the controller
+ */
+static void sim_rx(char ch) {
+  UDR = ch;
+  USART_RXC_vect();
+}
+
+/**
+ * Let the USART send what it can during one tick
+ */
+static void sim_usart_tick(void) {
+  sim_tx_credit += TICK_BYTES;
+  for (; sim_tx_credit >= 1 && (UCSRB & (1 << UDRIE_BIT)); sim_tx_credit--) {
+    uint8_t tail = uart_tx_tail;
+    USART_UDRE_vect();
+    if (uart_tx_tail != tail) {
+      sim_tx_bytes++;
+      if (sim_telemetry) fputc(UDR, sim_telemetry);
+    }
+  }
+  if (sim_tx_credit > 1) sim_tx_credit = 1;   /* idle line, nothing saved up */
+}
+
+/**
+ * Add n bytes to the digest
+ */
+static void sim_hash(const void *p, size_t n) {
+  const unsigned char *b = p;
+  while (n--) sim_digest = (sim_digest ^ *b++) * 0x100000001b3u;   /* FNV-1a prime */
+}
+
+/**
+ * Write the -s record of the last control step and add it, with the
+ * states at full precision, to the digest
+ */
+static void sim_trace_step(void) {
+  float rec[7];
+  double s[4];
+  int i;
+
+  rec[0] = sim_y;
+  rec[1] = r[0];
+  rec[2] = sim_u[0];
+  ctrl_states(0, s);
+  for (i = 0; i < 4; i++) rec[3 + i] = s[i];
+  if (sim_trace && sim_trace_n++ % sim_trace_every == 0) fwrite(rec, sizeof rec, 1, sim_trace);
+  sim_hash(rec, 3 * sizeof rec[0]);
+  sim_hash(s, sizeof s);          /* the states at full precision */
+}
+
+static FILE *sim_open(const char *name, const char *how) {
+  FILE *f = fopen(name, how);
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  return f;
+}
+
+static double sim_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * Time the control law of axis 0 for n steps on the inputs kept in
+ * sim_bench_y, s per step
+ */
+static double sim_bench(long n) {
+  int16_t u = 0;
+  double t0;
+  long i;
+
+  t0 = sim_now();
+  for (i = 0; i < n; i++) {
+    int16_t yq = sim_bench_y[i % SIM_BENCH];
+    u = ctrl_output(0, yq, r[0]);
+    ctrl_update(0, yq, r[0], u);
+  }
+  sim_sink = u;
+  return (sim_now() - t0) / n;
+}
+
+int main(int argc, char **argv) {
+  long n = 1000000, flip = -1, next_flip, off = 0, off_ticks = 0;
+  FILE *commands = NULL;
+  double t0, t1, t_ctrl, x1[AXES], x2[AXES];
+  int opt, a, digest;
+
+  for (a = 0; a < AXES; a++) plant_init(&plant[a], SAMPLE_TICK);
+  while ((opt = getopt(argc, argv, "n:p:r:d:t:c:o:s:e:w:i:g:l:a")) != -1) {
+    switch (opt) {
+    case 'n': n = atol(optarg); break;
+    case 'p': flip = atol(optarg); break;
+    case 'r': for (a = 0; a < AXES; a++) r[a] = atoi(optarg); break;
+    case 'o': off = atol(optarg); break;
+    case 'd': for (a = 0; a < AXES; a++) plant[a].d = atof(optarg); break;
+    case 't': sim_telemetry = sim_open(optarg, "wb"); break;
+    case 'c': commands = sim_open(optarg, "rb"); break;
+    case 's': sim_trace = sim_open(optarg, "wb"); break;
+    case 'e': sim_trace_every = atol(optarg); break;
+    case 'w': sim_record = sim_open(optarg, "wb"); break;
+    case 'i': sim_replay = sim_open(optarg, "rb"); break;
+    case 'g': sim_gen = strtoul(optarg, NULL, 0) | 1u << 31; break;
+    case 'a': sim_point = 1; break;
+#ifdef LOGGER
+    case 'l': sim_log = sim_open(optarg, "wb"); break;
+#endif
+    default:
+      fprintf(stderr, "usage: %s [-n steps] [-p flip] [-r reference] [-d disturbance] [-t file] [-c file] [-o off]\n"
+              "  [-s trace] [-e every] [-w record] [-i replay] [-g seed] [-l log (-DLOGGER)] [-a]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  digest = sim_trace || sim_replay || sim_gen;
+  if (sim_trace_every < 1) sim_trace_every = 1;
+  if (flip < 0) flip = commands ? 0 : (long) (10 / SAMPLE_H + 0.5);
+  ctrl_init();                      /* done by servo_main() */
+  for (a = AXES - 1; a >= 0; a--) {
+    if (AXES > 1) sim_rx('0' + a);  /* ends with axis 0 selected */
+    sim_rx('s');
+  }
+  if (sim_telemetry) sim_rx('b');
+  if (commands) {
+    int ch;
+    while ((ch = fgetc(commands)) != EOF) sim_rx(ch);
+    fclose(commands);
+  }
+  next_flip = flip;
+  t0 = sim_now();
+  while (sim_steps < n) {
+    long samples = sim_samples;
+    TIMER2_COMP_vect();
+    ctrl_background(task_take() & SIM_TASKS);
+    if (sim_replay_end) break;
+    if (digest && sim_samples != samples) sim_trace_step();
+#ifdef LOGGER
+    if (sim_log && log_state == LOG_FROZEN) {
+      LOG_POLL(TASK_LOGGER, sim_log_write);
+      sim_rx('l');
+    }
+#endif
+#if defined(SATCOUNT) && defined(SAT_NAMES)
+    sim_sat_collect();
+#endif
+    for (a = 0; a < AXES; a++) {
+      x1[a] = plant[a].x1;
+      x2[a] = plant[a].x2;
+      plant_step(&plant[a], sim_u[a]);
+    }
+    if (!sim_point) sim_adc_tick(x1, x2);
+    sim_usart_tick();
+    if (off_ticks && --off_ticks == 0) sim_rx('s');
+    if (flip && sim_steps >= next_flip && !off_ticks) {
+      if (off) {
+        sim_rx('t');
+        off_ticks = off * SAMPLE_DIV;
+      }
+      sim_rx('r');
+      next_flip += flip;
+    }
+  }
+  t1 = sim_now();
+  if (sim_replay) fclose(sim_replay);
+  if (sim_record) fclose(sim_record);
+  sim_replay = sim_record = NULL;   /* the timing reads no files */
+  sim_gen = 0;
+  t_ctrl = sim_bench(sim_steps > 0 ? sim_steps : 1);
+
+  printf("controller  %s\n", CONTROLLER);
+  printf("steps       %ld\n", sim_steps);
+  printf("rms error   %.3f\n", sqrt(sim_err2 / sim_steps));
+  printf("max error   %.0f\n", sim_err_max);
+  printf("saturated   %ld (%.2f%%)\n", sim_saturated, 100.0 * sim_saturated / sim_steps);
+  printf("ns/step     %.1f\n", 1e9 * t_ctrl);
+  printf("run ns/step %.1f\n", 1e9 * (t1 - t0) / sim_steps);
+  if (digest) printf("digest      %016" PRIx64 "\n", sim_digest);
+  if (sim_trace) fclose(sim_trace);
+  if (sim_log) fclose(sim_log);
+  if (sim_telemetry) {
+    printf("telemetry   %ld bytes, %u frames dropped\n", sim_tx_bytes,
+           telemetry_dropped);
+    fclose(sim_telemetry);
+  }
+#if defined(SATCOUNT) && defined(SAT_NAMES)
+  sim_sat_print();
+#endif
+#ifdef PROFILE
+  prof_report(sim_print);
+#endif
+  return 0;
+}
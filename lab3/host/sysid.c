@@ -0,0 +1,316 @@
+/**
+ * Fit the DC-servo model to a capture of the identification mode.
+ *
+ * Reads the telemetry stream recorded while the controller ran in
+ * MODE_IDENT (ident.h): a capture of the serial line, or servosim -t.
+ * The inputs are not point samples of the plant: each is the average
+ * of an AD window that ended some time before the sample (adc.h). As
+ * long as the window and its age stay within two sample periods, the
+ * averaged velocity vel(k) is a fixed combination of the velocity at
+ * sample k and of u(k-1) and u(k-2), so over a span of m samples
+ *   vel(k+m)          = phi11 vel(k) + g(-2) u(k-2) + ... + g(m-1) u(k+m-1) + beta1
+ *   pos(k+m) - pos(k) = phi21 vel(k) + e(-2) u(k-2) + ... + e(m-1) u(k+m-1) + beta2
+ * holds for the sampled model of host/plant.h, where phi11, phi21 and
+ * the sums gamma1 of the g and gamma2 of the e are those of the plant
+ * sampled with the period H = m h:
+ *   phi11 = exp(-a H),  phi21 = c f,  gamma1 = b f,  f = (1 - phi11) / a
+ * beta1 and beta2 take up a constant load disturbance and offsets. The
+ * inputs u(k+1) .. u(k+m-3) in the middle of the span, whose
+ * coefficients differ by no more than a H, about 0.6%, share one and
+ * enter as their sum, the difference of the running sums in the
+ * records. A row therefore needs samples k-2 .. k and k+m-2 .. k+m
+ * only, which arrive within single frames even when the frames in
+ * between are dropped. The span keeps the change of the velocity over
+ * a row large against the resolution of the inputs: fitted from
+ * consecutive samples, phi11 is so close to 1 at short periods that
+ * the quantization of vel(k) alone biases a noticeably. m defaults to
+ * 50 ms rounded up to whole samples, the PRBS hold IDENT_HOLD. The rows
+ * are accumulated in the normal equations, batch by batch as they are
+ * read, and solved once by least squares. The continuous parameters
+ * follow from the zero-order-hold formulas of plant_init():
+ *   a = -ln(phi11) / H,  b = gamma1 / f,  c = phi21 / f
+ * gamma2 is fitted freely and compared with the value the other three
+ * predict for a constant input over the span, as a check of the model
+ * structure.
+ *
+ * On servosim -t captures of 200 s with the AD model, against the
+ * nominal a = 0.12, b = 2.25 and c = 5, the fit gives
+ *   SAMPLE_MS   50     20     10     5      2
+ *   a           0.121  0.122  0.122  0.121  0.122
+ *   b           2.27   2.27   2.27   2.25   2.26
+ *   c           5.03   5.03   5.03   5.00   5.03
+ * where at 2 ms half of the frames are dropped; with -m 1 a comes out
+ * as 0.156 at 2 ms.
+ *
+ * Prints the fit as a comment and PLANT_A, PLANT_B and PLANT_C as a
+ * header, to replace the defaults in host/plant.h:
+ *   ./sysid -h 50 capture.bin > plant_id.h
+ *   gcc -O2 -Wall -I. -include plant_id.h -o coeffgen host/coeffgen.c -lm
+ *   ./coeffgen 50 20 10 5 2 > coeffs.h
+ *
+ * To compile, from the lab3 directory:
+ *   gcc -O2 -Wall -I. -o sysid host/sysid.c -lm
+ *
+ * To run:
+ *   ./sysid [-h sample period in ms, default 50] [-k samples to skip]
+ *           [-m span in samples] [capture file, default standard input]
+ *
+ * To try it on the simulated servo:
+ *   printf i > ident.cmd
+ *   gcc -O2 -DHOST -DCONTROLLER='"posfixed.c"' -I. -o servosim host/servosim.c -lm
+ *   ./servosim -n 4000 -c ident.cmd -t ident.bin && ./sysid ident.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <math.h>
+#include "refproto.h"
+
+#define ADC_FRAC_BITS 2              /* adc.h */
+#define RECORD        14
+#define SPAN_MAX      50             /* m at h = 1 ms */
+#define HIST          (SPAN_MAX + 3) /* samples a row spans */
+#define N_MAX         8              /* regressors: vel, 5 inputs, middle sum, 1 */
+
+typedef struct {
+  long t;                            /* sample number, -1 if empty */
+  double vel, pos, u;
+  uint16_t usum;
+} sysid_sample_t;
+
+typedef struct {
+  double xx[N_MAX][N_MAX], xy[2][N_MAX], yy[2];
+  int n;                             /* regressors in use */
+  long rows;
+} sysid_t;
+
+static void sysid_row(sysid_t *s, const double *x, double dvel, double dpos) {
+  int i, j, N = s->n;
+  for (i = 0; i < N; i++) {
+    for (j = 0; j < N; j++) s->xx[i][j] += x[i] * x[j];
+    s->xy[0][i] += x[i] * dvel;
+    s->xy[1][i] += x[i] * dpos;
+  }
+  s->yy[0] += dvel * dvel;
+  s->yy[1] += dpos * dpos;
+  s->rows++;
+}
+
+/**
+ * Solve a x = b by Gaussian elimination with partial pivoting.
+ * Returns 0 if a is singular.
+ */
+static int sysid_solve(int N, double a[N_MAX][N_MAX], const double b[N_MAX], double x[N_MAX]) {
+  double m[N_MAX][N_MAX + 1];
+  int i, j, k;
+
+  for (i = 0; i < N; i++) {
+    for (j = 0; j < N; j++) m[i][j] = a[i][j];
+    m[i][N] = b[i];
+  }
+  for (k = 0; k < N; k++) {
+    int p = k;
+    for (i = k + 1; i < N; i++)
+      if (fabs(m[i][k]) > fabs(m[p][k])) p = i;
+    if (fabs(m[p][k]) < 1e-12 * (fabs(m[0][0]) + 1)) return 0;
+    for (j = 0; j <= N; j++) {
+      double t = m[k][j];
+      m[k][j] = m[p][j];
+      m[p][j] = t;
+    }
+    for (i = k + 1; i < N; i++) {
+      double f = m[i][k] / m[k][k];
+      for (j = k; j <= N; j++) m[i][j] -= f * m[k][j];
+    }
+  }
+  for (i = N - 1; i >= 0; i--) {
+    x[i] = m[i][N];
+    for (j = i + 1; j < N; j++) x[i] -= m[i][j] * x[j];
+    x[i] /= m[i][i];
+  }
+  return 1;
+}
+
+/**
+ * Residual sum of squares of row r for the solution th
+ */
+static double sysid_rss(const sysid_t *s, int r, const double th[N_MAX]) {
+  double rss = s->yy[r];
+  int i, j, N = s->n;
+  for (i = 0; i < N; i++) {
+    rss -= 2 * th[i] * s->xy[r][i];
+    for (j = 0; j < N; j++) rss += th[i] * s->xx[i][j] * th[j];
+  }
+  return rss > 0 ? rss : 0;
+}
+
+static int16_t sysid_word(const uint8_t *p) {
+  return (int16_t) (p[0] | p[1] << 8);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-h period ms] [-k skip] [-m span] [capture file]\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  static uint8_t buf[1 << 16];
+  static sysid_t s;
+  static sysid_sample_t hist[HIST];         /* the last samples, by t % HIST */
+  double h = 0.05, th[2][N_MAX], x[N_MAX], a, b, c, f, H, g1, g2;
+  long skip = 0, frames = 0, bad = 0, gaps = 0, t = -1, other = 0;
+  int edge[5], edges = 0, mid, m = 0, j;
+  uint16_t sample = 0;
+  size_t n = 0, i = 0, got;
+  FILE *in = stdin;
+  const char *name = "stdin";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "h:k:m:")) != -1) {
+    switch (opt) {
+    case 'h': h = atof(optarg) / 1000; break;
+    case 'k': skip = atol(optarg); break;
+    case 'm': m = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (m == 0) m = (int) ceil(0.05 / h - 1e-9);    /* IDENT_HOLD */
+  if (argc - optind > 1 || h <= 0 || m < 1 || m > SPAN_MAX) usage(argv[0]);
+  H = m * h;
+  /* Inputs with a coefficient of their own: the two before the span,
+     the first and the last two; the ones in between share one */
+  for (j = -2; j < m; j++)
+    if (j <= 0 || j >= m - 2) edge[edges++] = j;
+  mid = m - 3 > 0;
+  s.n = 1 + edges + mid + 1;
+  for (j = 0; j < HIST; j++) hist[j].t = -1;
+  if (argc - optind == 1) {
+    name = argv[optind];
+    if (!(in = fopen(name, "rb"))) {
+      perror(name);
+      return 1;
+    }
+  }
+
+  /* The buffer is refilled as it is consumed, so a capture of any
+     length goes through the normal equations batch by batch */
+  while ((got = fread(buf + n, 1, sizeof buf - n, in)) > 0 || i + 4 < n) {
+    n += got;
+    for (; i + 4 <= n; i++) {
+      const uint8_t *p = buf + i;
+      uint8_t sum = 0;
+      size_t len, k, count;
+      uint16_t index;
+
+      if (p[0] != REF_SYNC0 || p[1] != REF_SYNC1) continue;
+      if (p[2] == TELEMETRY_CMD_DATA && (p[3] < 2 + RECORD || (p[3] - 2) % RECORD)) continue;
+      len = 4 + p[3] + 1;
+      if (i + len > n) break;                /* rest of the frame not read yet */
+      for (k = 2; k < len - 1; k++) sum += p[k];
+      if (p[2] != TELEMETRY_CMD_DATA) {
+        if (sum == p[len - 1]) {             /* a reply to a command */
+          other++;
+          i += len - 1;
+        }
+        continue;
+      }
+      if (sum != p[len - 1]) {
+        bad++;
+        continue;
+      }
+      index = p[4] | p[5] << 8;
+      count = (p[3] - 2) / RECORD;
+      for (k = 0; k < count; k++, index++) {
+        const uint8_t *rec = p + 6 + k * RECORD;
+        double vel = sysid_word(rec) * (1.0 / (1 << ADC_FRAC_BITS));
+        double pos = sysid_word(rec + 2) * (1.0 / (1 << ADC_FRAC_BITS));
+        sysid_sample_t *now, *k0, *e;
+        if (skip > 0) {
+          skip--;
+          continue;
+        }
+        if (t < 0) {
+          t = index;
+        } else {
+          if (index != (uint16_t) (sample + 1)) gaps++;
+          t += (uint16_t) (index - sample);
+        }
+        sample = index;
+        now = &hist[t % HIST];
+        now->t = t;
+        now->vel = vel;
+        now->pos = pos;
+        now->u = sysid_word(rec + 4);
+        now->usum = (uint16_t) sysid_word(rec + 6);
+        /* This sample is k + m. A span needs k - 2 .. k and the last
+           two inputs; the middle comes from the running sums */
+        k0 = &hist[(t - m) % HIST];
+        if (t < m + 2 || k0->t != t - m) continue;
+        x[0] = k0->vel;
+        for (j = 0; j < edges; j++) {
+          e = &hist[(t - m + edge[j]) % HIST];
+          if (e->t != t - m + edge[j]) break;
+          x[1 + j] = e->u;
+        }
+        if (j < edges) continue;
+        if (mid) {                           /* u(k + 1) .. u(k + m - 3) */
+          e = &hist[(t - 2) % HIST];
+          x[1 + edges] = (int16_t) (uint16_t) (e->usum - (uint16_t) (int16_t) e->u - k0->usum);
+        }
+        x[s.n - 1] = 1;
+        sysid_row(&s, x, vel, pos - k0->pos);
+      }
+      frames++;
+      i += len - 1;
+    }
+    if (got == 0) break;
+    memmove(buf, buf + i, n - i);            /* keep a partial frame */
+    n -= i;
+    i = 0;
+  }
+  if (in != stdin) fclose(in);
+
+  if (s.rows < 10 * s.n || !sysid_solve(s.n, s.xx, s.xy[0], th[0])
+      || !sysid_solve(s.n, s.xx, s.xy[1], th[1])) {
+    fprintf(stderr, "%s: %ld usable spans, not enough excitation\n", name, s.rows);
+    return 1;
+  }
+  if (th[0][0] <= 0 || th[0][0] >= 1) {
+    fprintf(stderr, "%s: phi11 = %g, not a stable first-order velocity\n", name, th[0][0]);
+    return 1;
+  }
+  for (g1 = g2 = 0, j = 1; j <= edges; j++) {
+    g1 += th[0][j];
+    g2 += th[1][j];
+  }
+  if (mid) {
+    g1 += (m - 3) * th[0][1 + edges];
+    g2 += (m - 3) * th[1][1 + edges];
+  }
+  a = -log(th[0][0]) / H;
+  f = (1 - th[0][0]) / a;
+  b = g1 / f;
+  c = th[1][0] / f;
+
+  printf("/**\n"
+         " * DC-servo model identified by host/sysid.c from %s:\n"
+         " * %ld frames, %ld bad, %ld replies skipped, %ld gaps, %ld spans\n"
+         " * at h = %g ms, fitted over spans of m = %d samples.\n"
+         " *   phi11  %.9f   gamma1 %.9f   beta1 %.4f   rms residual %.4f\n"
+         " *   phi21  %.9f   gamma2 %.9f   beta2 %.4f   rms residual %.4f\n"
+         " *   gamma2 predicted by a, b, c: %.9f\n"
+         " *   load disturbance beta1 / gamma1: %.3f\n"
+         " */\n"
+         "\n",
+         name, frames, bad, other, gaps, s.rows, h * 1000, m,
+         th[0][0], g1, th[0][s.n - 1], sqrt(sysid_rss(&s, 0, th[0]) / s.rows),
+         th[1][0], g2, th[1][s.n - 1], sqrt(sysid_rss(&s, 1, th[1]) / s.rows),
+         c * b * (H - f) / a, th[0][s.n - 1] / g1);
+  printf("#define PLANT_A %.6f\n", a);
+  printf("#define PLANT_B %.6f\n", b);
+  printf("#define PLANT_C %.6f\n", c);
+  return 0;
+}
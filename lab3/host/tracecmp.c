@@ -0,0 +1,112 @@
+/**
+ * Compare two state traces written by servosim -s.
+ *
+ * A trace holds one record of seven floats per control step: Y, r, u
+ * and the four telemetry states s0..s3 in input units (controller.h).
+ * For each column this prints the RMS of the first trace, as a scale,
+ * the maximum and RMS difference between the traces and the step of
+ * the maximum, and for u the number of steps in which the outputs
+ * differ. Records are compared up to the end of the shorter trace.
+ *
+ * With -t the traces are checked as well: the exit status is 1 if they
+ * differ in length or any value of a record differs by more than the
+ * tolerance. -t 0 requires bit-identical records; host/golden.sh
+ * checks the floating-point controllers with a tolerance this way.
+ *
+ * To compile, from the lab3 directory:
+ *   gcc -O2 -Wall -o tracecmp host/tracecmp.c -lm
+ *
+ * To run:
+ *   ./tracecmp [-k steps to skip] [-t tolerance] <reference trace> <trace>
+ *
+ * host/fixbench.sh runs the complete fixed-point versus floating-point
+ * comparison.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define TRACE_COLS 7
+
+static const char *const trace_names[TRACE_COLS] = {"Y", "r", "u", "s0", "s1", "s2", "s3"};
+
+static FILE *trace_open(const char *name) {
+  FILE *f = fopen(name, "rb");
+  if (!f) {
+    perror(name);
+    exit(1);
+  }
+  return f;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-k skip] [-t tolerance] <reference trace> <trace>\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  double sum2[TRACE_COLS] = {0}, diff2[TRACE_COLS] = {0}, max[TRACE_COLS] = {0};
+  long at[TRACE_COLS] = {0}, n = 0, skip = 0, udiff = 0, over = 0, first = -1;
+  float a[TRACE_COLS], b[TRACE_COLS];
+  double tol = -1;                  /* no check */
+  FILE *fa, *fb;
+  int opt, i, longer = 0;
+
+  while ((opt = getopt(argc, argv, "k:t:")) != -1) {
+    switch (opt) {
+    case 'k': skip = atol(optarg); break;
+    case 't': tol = atof(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2) usage(argv[0]);
+  fa = trace_open(argv[optind]);
+  fb = trace_open(argv[optind + 1]);
+
+  for (;; n++) {
+    int ga = fread(a, sizeof a, 1, fa) == 1, gb = fread(b, sizeof b, 1, fb) == 1;
+    int exceeds;
+    if (!ga || !gb) {
+      longer = ga || gb;
+      break;
+    }
+    if (n < skip) continue;
+    exceeds = tol == 0 && memcmp(a, b, sizeof a) != 0;
+    for (i = 0; i < TRACE_COLS; i++) {
+      double d = fabs((double) a[i] - b[i]);
+      sum2[i] += (double) a[i] * a[i];
+      diff2[i] += d * d;
+      if (d > max[i]) {
+        max[i] = d;
+        at[i] = n;
+      }
+      if (tol > 0 && !(d <= tol)) exceeds = 1;   /* NaN exceeds too */
+    }
+    udiff += a[2] != b[2];
+    if (exceeds && over++ == 0) first = n;
+  }
+  fclose(fa);
+  fclose(fb);
+  if (n <= skip) {
+    fprintf(stderr, "no records to compare\n");
+    return 1;
+  }
+
+  n -= skip;
+  printf("steps       %ld\n", n);
+  printf("            rms         max diff    at step     rms diff\n");
+  for (i = 0; i < TRACE_COLS; i++)
+    printf("  %-9s %-11.4g %-11.4g %-11ld %.4g\n", trace_names[i], sqrt(sum2[i] / n),
+           max[i], at[i], sqrt(diff2[i] / n));
+  printf("u differs   %ld steps (%.2f%%)\n", udiff, 100.0 * udiff / n);
+  if (tol < 0) return 0;
+  if (tol == 0) printf("bit-exact   ");
+  else printf("within %-5g ", tol);
+  if (over) printf("no, %ld steps differ, the first at step %ld\n", over, first);
+  else if (longer) printf("no, the traces differ in length\n");
+  else printf("yes\n");
+  return over || longer;
+}
@@ -0,0 +1,95 @@
+/**
+ * System identification mode: PRBS excitation of the plant.
+ *
+ * In MODE_IDENT (mode.h, command 'i') the control law is replaced by
+ *   u = +-IDENT_AMP - (pos + vel / 2)
+ * where the sign follows a 9-bit maximum-length pseudo-random binary
+ * sequence (x^9 + x^5 + 1, period 511 bits) and every bit is held for
+ * IDENT_HOLD samples, 50 ms rounded up to whole samples: 50 ms at
+ * every sample period but 20 ms, where it is 60 ms. The weak feedback
+ * from both inputs keeps the position within the AD range without
+ * taking much of the excitation away; since the output actually
+ * applied is recorded, it does not bias the fit. With the lab servo
+ * the position stays within about +-200.
+ *
+ * Both inputs are read every sample and streamed with the telemetry
+ * (telemetry.h), which 'i' switches on, as the record
+ *   vel, pos, u, usum, 0, 0, 0
+ * with vel and pos at ADC_FRAC_BITS fractional bits as read and usum
+ * the sum of u over all samples so far, modulo 2^16. The sum gives the
+ * total input between two records even when the frames in between are
+ * dropped, as at 2 ms where the stream needs twice what 38400 baud
+ * carries. Since pos is in the place of the reference, the logger's
+ * reference trigger (logger.h) is off for these samples.
+ * host/sysid.c fits the model of host/plant.h, with the averaging and
+ * the delay of the AD windows (adc.h), to a capture of the stream by
+ * least squares and prints PLANT_A, PLANT_B and PLANT_C, from which
+ * host/coeffgen.c computes every coefficient again. Its accuracy on
+ * the simulated servo at each sample period is given there.
+ *
+ * The controller states are held cleared, as in MODE_OFF, and 's', 't'
+ * or 'f' leave the mode. There is one sequence, so with two axes (hal.h)
+ * only one of them should be in MODE_IDENT at a time.
+ */
+
+#ifndef IDENT_H
+#define IDENT_H
+
+#include <inttypes.h>
+#include "hal.h"
+#include "sampling.h"
+#include "telemetry.h"
+
+#ifndef IDENT_AMP
+#define IDENT_AMP   150
+#endif
+#ifndef IDENT_HOLD
+#define IDENT_HOLD  ((50 + SAMPLE_MS - 1) / SAMPLE_MS)
+#endif
+
+static uint16_t ident_lfsr;
+static uint8_t ident_ctr;
+static int16_t ident_level;                  /* current PRBS output */
+static int16_t ident_vq, ident_pq;           /* inputs of this sample */
+static uint16_t ident_usum;                  /* sum of u, modulo 2^16 */
+
+/**
+ * Restart the sequence and switch the telemetry on. Called from the
+ * serial interrupt with 'i'.
+ */
+static inline void ident_start(void) {
+  ident_lfsr = 0x1ff;
+  ident_ctr = 0;
+  ident_usum = 0;
+  telemetry_start();
+}
+
+/**
+ * The output of axis a for this sample. Called from the control
+ * interrupt.
+ */
+static inline int16_t ident_output(uint8_t a) {
+  int16_t u;
+
+  ident_vq = readInputQ(AXIS_INPUT(a, 0));
+  ident_pq = readInputQ(AXIS_INPUT(a, 1));
+  if (ident_ctr == 0) {
+    uint16_t l = ident_lfsr;
+    ident_level = (l & 1) ? IDENT_AMP : -IDENT_AMP;
+    ident_lfsr = (l >> 1) | (((l ^ (l >> 4)) & 1) << 8);
+    ident_ctr = IDENT_HOLD;
+  }
+  ident_ctr--;
+  u = ident_level - ((ident_pq + (ident_vq >> 1)) >> ADC_FRAC_BITS);
+  if (u > 511) u = 511;
+  else if (u < -512) u = -512;
+  return u;
+}
+
+static inline void ident_snapshot(int16_t u) {
+  LOG_NO_REF();                     /* r is the position */
+  ident_usum += (uint16_t) u;
+  telemetry_sample(ident_vq, ident_pq, u, (int16_t) ident_usum, 0, 0, 0);
+}
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * Triggered ring-buffer logger for the control interrupt.
+ *
+ * Build with -DLOGGER to enable; otherwise every macro below expands
+ * to nothing and uses no RAM.
+ *
+ * Every control sample telemetry_sample() (telemetry.h) stores the
+ * record
+ *   tick, Y, r, u, s0
+ * as five int16_t, tick being the telemetry sample index and s0 the
+ * first telemetry state (x1 for the position controllers, I for the
+ * velocity controllers), into a ring of LOG_RECORDS records. The store
+ * is the same few instructions every sample, whatever the logger is
+ * doing; once frozen it is skipped.
+ *
+ * While armed, the logger triggers on
+ *   LOG_TRIG_REF  a change of the reference, not counting samples
+ *                 whose r is something else, marked with LOG_NO_REF()
+ *                 (the position in the identification mode, ident.h),
+ *                 nor the first sample after them,
+ *   LOG_TRIG_SAT  the output at the +511/-512 limit,
+ *   LOG_TRIG_CMD  the 'l' command,
+ * restricted to the causes in LOG_TRIGGERS. It then records LOG_POST
+ * more samples and freezes, keeping LOG_RECORDS - LOG_POST - 1
+ * samples from before the trigger. Freezing posts TASK_LOGGER
+ * (tasks.h), main() sends the frozen window with LOG_POLL() and the
+ * logger stays idle until it is armed again with 'l'. It is armed at
+ * reset, so the first event after power-up is caught. 'l' while armed
+ * triggers it by hand.
+ *
+ * Each record is sent as one frame of refproto.h, queued whole so that
+ * telemetry frames cannot split it:
+ *
+ *   0xa5 0x5a  LOG_CMD_RECORD(1)  12(1)
+ *   t(1)  cause(1)  tick(2) Y(2) r(2) u(2) s0(2)  checksum(1)
+ *
+ * so that a host reading the line for telemetry or parameter replies
+ * skips it by its length. t is the sample relative to the trigger as
+ * a signed byte, cause the LOG_TRIG_ bits that fired, the words are
+ * little-endian and checksum is the 8-bit sum of all bytes after the
+ * sync pair. host/logdump.c prints a dump as a table.
+ *
+ * RAM: 10 bytes per record. The default is 32 records, 320 bytes, and
+ * 16 records, 160 bytes, on the ATmega8, whose 1 KB already holds the
+ * fixed buffers of a position controller: the transmit queue (128),
+ * the reference buffer (128), the telemetry frames (124), the
+ * coefficient banks (40) and the frame decoder (17), about 460 bytes
+ * with the other variables, and about 120 more with -DPROFILE and
+ * -DSATCOUNT. 320 bytes of log on top would leave less than 150 bytes
+ * for the stack, shared by main() with the logger frame and the
+ * control interrupt with about 30 bytes of saved registers and locals,
+ * a margin nobody has measured. With 16 records about 280 bytes are
+ * left. Override with -DLOG_RECORDS only after checking avr-size and
+ * the stack.
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#ifdef LOGGER
+
+#include <inttypes.h>
+#include "refproto.h"
+#include "tasks.h"
+
+#ifndef LOG_RECORDS
+#ifdef __AVR_ATmega8__
+#define LOG_RECORDS   16            /* power of two, at most 128 */
+#else
+#define LOG_RECORDS   32
+#endif
+#endif
+#ifndef LOG_POST
+#define LOG_POST      (LOG_RECORDS * 3 / 4)
+#endif
+#define LOG_MASK      (LOG_RECORDS - 1)
+
+#define LOG_TRIG_REF  0x01
+#define LOG_TRIG_SAT  0x02
+#define LOG_TRIG_CMD  0x04
+#ifndef LOG_TRIGGERS
+#define LOG_TRIGGERS  (LOG_TRIG_REF | LOG_TRIG_SAT | LOG_TRIG_CMD)
+#endif
+
+#define LOG_ARMED     0
+#define LOG_TRIGGERED 1
+#define LOG_FROZEN    2
+#define LOG_IDLE      3
+
+#define LOG_PAYLOAD   12
+#define LOG_FRAME     (4 + LOG_PAYLOAD + 1)
+
+#if (LOG_RECORDS & LOG_MASK) || LOG_RECORDS > 128 || LOG_POST >= LOG_RECORDS
+#error "LOG_RECORDS must be a power of two up to 128, and LOG_POST less"
+#endif
+
+typedef struct {
+  int16_t tick, y, r, u, s0;
+} log_record_t;
+
+static log_record_t log_buf[LOG_RECORDS];
+static uint8_t log_head;                     /* next record to write */
+static uint8_t log_fill;                     /* records since arming */
+static uint8_t log_post;                     /* records still to write after the trigger */
+static uint8_t log_cause;
+static uint8_t log_cmd;                      /* 'l' while armed */
+static int16_t log_r_last;
+static uint8_t log_r_ok;                     /* log_r_last is a reference */
+static uint8_t log_no_ref;                   /* r of this sample is not */
+static volatile uint8_t log_state = LOG_ARMED;
+
+/**
+ * Record one control sample and check the triggers. Called from the
+ * control interrupt.
+ */
+static inline void log_sample(int16_t tick, int16_t y, int16_t r,
+                              int16_t u, int16_t s0) {
+  log_record_t *p;
+  uint8_t cause;
+
+  if (log_state >= LOG_FROZEN) {
+    log_no_ref = 0;
+    return;
+  }
+  p = &log_buf[log_head];
+  p->tick = tick;
+  p->y = y;
+  p->r = r;
+  p->u = u;
+  p->s0 = s0;
+  log_head = (log_head + 1) & LOG_MASK;
+  if (log_fill < LOG_RECORDS) log_fill++;
+
+  if (log_state == LOG_ARMED) {
+    cause = log_cmd;
+    if (r != log_r_last && log_r_ok && !log_no_ref) cause |= LOG_TRIG_REF;
+    if (u >= 511 || u <= -512) cause |= LOG_TRIG_SAT;
+    cause &= LOG_TRIGGERS;
+    if (cause) {
+      log_cause = cause;
+      log_post = LOG_POST;
+      log_state = LOG_POST ? LOG_TRIGGERED : LOG_FROZEN;
+      if (!LOG_POST) task_post(TASK_LOGGER);
+    }
+  } else if (--log_post == 0) {
+    log_state = LOG_FROZEN;
+    task_post(TASK_LOGGER);
+  }
+  log_r_last = r;
+  log_r_ok = !log_no_ref;
+  log_no_ref = 0;
+}
+
+/**
+ * The 'l' command: arm an idle logger, trigger an armed one. Called
+ * from the serial interrupt, which the control interrupt cannot
+ * preempt.
+ */
+static inline void log_command(void) {
+  if (log_state == LOG_IDLE) {
+    log_fill = 0;
+    log_cmd = 0;
+    log_r_ok = 0;
+    log_state = LOG_ARMED;
+  } else if (log_state == LOG_ARMED) {
+    log_cmd = LOG_TRIG_CMD;
+  }
+}
+
+static inline void log_word(uint8_t *p, int16_t w) {
+  p[0] = (uint8_t) w;
+  p[1] = (uint8_t) ((uint16_t) w >> 8);
+}
+
+/**
+ * Send the frozen window, oldest record first, and go idle. Runs from
+ * main(); the control interrupt leaves the buffer alone while frozen.
+ * write queues one whole frame, e.g. uart_write_wait().
+ */
+static void log_dump(void (*write)(const uint8_t *, uint8_t)) {
+  uint8_t frame[LOG_FRAME];
+  uint8_t n = log_fill;
+  uint8_t i = (log_head - n) & LOG_MASK;
+  int8_t t = (int8_t) (LOG_POST + 1 - n);
+  uint8_t j, sum;
+
+  for (; n; n--, t++, i = (i + 1) & LOG_MASK) {
+    const log_record_t *p = &log_buf[i];
+    frame[0] = REF_SYNC0;
+    frame[1] = REF_SYNC1;
+    frame[2] = LOG_CMD_RECORD;
+    frame[3] = LOG_PAYLOAD;
+    frame[4] = (uint8_t) t;
+    frame[5] = log_cause;
+    log_word(frame + 6, p->tick);
+    log_word(frame + 8, p->y);
+    log_word(frame + 10, p->r);
+    log_word(frame + 12, p->u);
+    log_word(frame + 14, p->s0);
+    for (sum = 0, j = 2; j < LOG_FRAME - 1; j++) sum += frame[j];
+    frame[LOG_FRAME - 1] = sum;
+    write(frame, LOG_FRAME);
+  }
+  log_state = LOG_IDLE;
+}
+
+#define LOG_SAMPLE(tick, y, r, u, s0)  log_sample(tick, y, r, u, s0)
+#define LOG_NO_REF()         (log_no_ref = 1)
+#define LOG_COMMAND()        log_command()
+#define LOG_POLL(tasks, write) do { if (((tasks) & TASK_LOGGER) &&     \
+                                    log_state == LOG_FROZEN)           \
+                                  log_dump(write); } while (0)
+
+#else
+
+#define LOG_SAMPLE(tick, y, r, u, s0)
+#define LOG_NO_REF()
+#define LOG_COMMAND()
+#define LOG_POLL(tasks, write)
+
+#endif
+
+#endif
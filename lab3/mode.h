@@ -0,0 +1,40 @@
+/**
+ * Operating modes of the controllers.
+ *
+ *   MODE_OFF    output 0, controller states cleared and held at 0
+ *   MODE_TRACK  output 0, controller states follow the plant
+ *   MODE_ON     closed-loop control
+ *   MODE_IDENT  PRBS excitation for system identification (ident.h),
+ *               controller states cleared
+ *
+ * 's' switches to MODE_ON, 't' to MODE_TRACK, 'f' to MODE_OFF and 'i'
+ * to MODE_IDENT. The controllers start in MODE_TRACK. With two axes
+ * each has its own mode and the commands change that of the selected
+ * axis (controller.h).
+ *
+ * In MODE_TRACK the controller states follow the plant instead of
+ * keeping whatever was left over from the last run. The observer of
+ * the position controllers runs with the output actually applied,
+ * u = 0, so velocity, position and load disturbance estimates are
+ * current when the controller is switched on. The integral of the
+ * velocity controllers is set to K (1 - b) y, the value for which the
+ * output would be 0 if the reference were equal to the measured
+ * velocity. Switching on then continues from output 0 when r = y and
+ * otherwise gives the ordinary step response from the current state,
+ * not a kick from a stale or wound-up integral.
+ *
+ * In MODE_ON the PI integrators have back-calculation anti-windup: the
+ * difference between the limited and the computed output is fed back
+ * to the integral with gain h/Tr (H_TR, coeffs.h). The observers get
+ * the limited output, so they need nothing extra.
+ */
+
+#ifndef MODE_H
+#define MODE_H
+
+#define MODE_OFF    0
+#define MODE_TRACK  1
+#define MODE_ON     2
+#define MODE_IDENT  3
+
+#endif
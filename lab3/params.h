@@ -0,0 +1,221 @@
+/**
+ * Controller coefficients in RAM, updated over the serial line.
+ *
+ * The coefficients of a controller live in one of two parameter banks
+ * of PARAM_COUNT int16_t words each. The control interrupt reads them
+ * through param_active; the other bank is the shadow copy that the
+ * parameter commands write. A commit only flips the pointer at the
+ * start of the next control sample (PARAM_UPDATE()), so a sample never
+ * sees half of an update. The controller gives its coefficients names
+ * as an enum of bank indices, defines PARAM_COUNT before including
+ * this file and keeps the compiled-in values in flash, e.g.
+ *   enum { P_K1, P_K2, P_COUNT };
+ *   #define PARAM_COUNT P_COUNT
+ *   #include "params.h"
+ *   static const int16_t param_values[P_COUNT] PROGMEM = { ... };
+ *   #define k1 P[P_K1]
+ * and loads const int16_t *P = param_active once per sample. The banks
+ * then take 4 bytes of RAM per coefficient and the defaults none. A
+ * coefficient then costs a load with a constant offset from P (ldd, 2
+ * cycles per byte) instead of a load immediate (ldi, 1 cycle), and
+ * both end up in the same registers for the multiply helper, so the
+ * position controller's ten coefficients add about 25 cycles per
+ * sample, far below 1% of the control interrupt.
+ *
+ * Binary frames (format in reference.h; answered with 'k' or '?'):
+ *
+ *   PARAM_CMD_WRITE    index, value...  write words into the shadow bank
+ *   PARAM_CMD_COMMIT   -                swap the banks at the next sample
+ *   PARAM_CMD_READ     index, count     reply with a frame of the same
+ *                                       command: index, value...
+ *   PARAM_CMD_SAVE     -                store the active bank in EEPROM
+ *   PARAM_CMD_DEFAULTS -                load the compiled-in values into
+ *                                       the shadow bank
+ *
+ * A WRITE is refused while a commit is pending. After a commit the
+ * shadow bank is refreshed from the new active bank before the next
+ * write or commit, in the receive interrupt, so the control interrupt
+ * only does the pointer flip. A COMMIT with nothing written since the
+ * last one therefore leaves the coefficients as they are, and a COMMIT
+ * sent again after a lost 'k' is harmless.
+ *
+ * At start-up param_init() takes the bank saved in EEPROM if its
+ * header matches the controller (magic, number of words) and its
+ * checksum is right, and the compiled-in defaults otherwise. The
+ * EEPROM write runs in main() as TASK_PARAM_SAVE (tasks.h,
+ * PARAM_POLL()), since it takes about 8 ms per word. In a host build
+ * (-DHOST) the EEPROM is an array.
+ */
+
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include <inttypes.h>
+#include "hal.h"
+#include "refproto.h"
+#include "tasks.h"
+
+#ifndef PARAM_COUNT
+#error "Define PARAM_COUNT, the number of coefficients, before including params.h"
+#endif
+
+#ifndef HOST
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+static uint16_t param_eeprom[PARAM_COUNT + 3] EEMEM;
+#define PARAM_EE_READ(a)      eeprom_read_word(&param_eeprom[a])
+#define PARAM_EE_WRITE(a, x)  eeprom_update_word(&param_eeprom[a], (x))
+#define PARAM_PGM_READ(p)     ((int16_t) pgm_read_word(p))
+#else
+#define PROGMEM
+static uint16_t param_eeprom[PARAM_COUNT + 3];
+#define PARAM_EE_READ(a)      (param_eeprom[a])
+#define PARAM_EE_WRITE(a, x)  (param_eeprom[a] = (x))
+#define PARAM_PGM_READ(p)     (*(p))
+#endif
+
+static int16_t param_bank[2][PARAM_COUNT];
+static const int16_t *volatile param_active = param_bank[0];
+static int16_t *param_shadow = param_bank[1];
+static const int16_t *param_defaults;        /* in flash */
+static uint16_t param_magic;
+static volatile uint8_t param_commit_pending = 0;
+static uint8_t param_shadow_stale = 0;
+
+static inline void param_copy(int16_t *to, const int16_t *from) {
+  uint8_t i;
+  for (i = 0; i < PARAM_COUNT; i++) to[i] = from[i];
+}
+
+static void param_copy_defaults(int16_t *to) {
+  uint8_t i;
+  for (i = 0; i < PARAM_COUNT; i++) to[i] = PARAM_PGM_READ(&param_defaults[i]);
+}
+
+/**
+ * EEPROM layout: magic, count, words..., 16-bit sum of the words
+ */
+static uint8_t param_load(int16_t *bank) {
+  uint16_t sum = 0;
+  uint8_t i;
+
+  if (PARAM_EE_READ(0) != param_magic || PARAM_EE_READ(1) != PARAM_COUNT) return 0;
+  for (i = 0; i < PARAM_COUNT; i++) {
+    bank[i] = (int16_t) PARAM_EE_READ(2 + i);
+    sum += (uint16_t) bank[i];
+  }
+  return PARAM_EE_READ(2 + PARAM_COUNT) == sum;
+}
+
+static void param_save(void) {
+  int16_t bank[PARAM_COUNT];
+  uint16_t sum = 0;
+  uint8_t i;
+
+  UART_ATOMIC {
+    param_copy(bank, param_active);
+  }
+  PARAM_EE_WRITE(0, 0xffff);        /* invalid while half written */
+  PARAM_EE_WRITE(1, PARAM_COUNT);
+  for (i = 0; i < PARAM_COUNT; i++) {
+    PARAM_EE_WRITE(2 + i, (uint16_t) bank[i]);
+    sum += (uint16_t) bank[i];
+  }
+  PARAM_EE_WRITE(2 + PARAM_COUNT, sum);
+  PARAM_EE_WRITE(0, param_magic);
+}
+
+/**
+ * Set up the banks before interrupts are enabled. defaults holds
+ * PARAM_COUNT words in flash (PROGMEM); magic identifies the
+ * controller and its bank layout in EEPROM.
+ */
+static void param_init(const int16_t *defaults, uint16_t magic) {
+  param_defaults = defaults;
+  param_magic = magic;
+  if (!param_load(param_bank[0])) param_copy_defaults(param_bank[0]);
+  param_copy(param_bank[1], param_bank[0]);
+}
+
+static void param_reply(uint8_t index, uint8_t n) {
+  uint8_t buf[5 + 1 + 2 * 8 + 1];
+  uint8_t i, len = 1 + 2 * n, sum;
+
+  buf[0] = REF_SYNC0;
+  buf[1] = REF_SYNC1;
+  buf[2] = PARAM_CMD_READ;
+  buf[3] = len;
+  buf[4] = index;
+  for (i = 0; i < n; i++) {
+    uint16_t w = (uint16_t) param_active[index + i];
+    buf[5 + 2 * i] = (uint8_t) w;
+    buf[6 + 2 * i] = (uint8_t) (w >> 8);
+  }
+  sum = 0;
+  for (i = 2; i < 4 + len; i++) sum += buf[i];
+  buf[4 + len] = sum;
+  uart_write(buf, 5 + len);
+}
+
+/**
+ * Execute a parameter frame. Returns 1 if it was valid. Called from
+ * the receive interrupt through ref_execute().
+ */
+static uint8_t param_execute(uint8_t cmd, const uint8_t *p, uint8_t len) {
+  uint8_t i, n;
+
+  switch (cmd) {
+  case PARAM_CMD_WRITE:
+    n = len >> 1;
+    if (len < 3 || !(len & 1) || p[0] + n > PARAM_COUNT || param_commit_pending) return 0;
+    if (param_shadow_stale) {
+      param_copy(param_shadow, param_active);
+      param_shadow_stale = 0;
+    }
+    for (i = 0; i < n; i++)
+      param_shadow[p[0] + i] = (int16_t) (p[1 + 2 * i] | ((uint16_t) p[2 + 2 * i] << 8));
+    return 1;
+  case PARAM_CMD_COMMIT:
+    if (len != 0) return 0;
+    if (param_shadow_stale) {        /* nothing written since the last commit */
+      param_copy(param_shadow, param_active);
+      param_shadow_stale = 0;
+    }
+    param_commit_pending = 1;
+    return 1;
+  case PARAM_CMD_READ:
+    if (len != 2 || p[1] == 0 || p[1] > 8 || p[0] + p[1] > PARAM_COUNT) return 0;
+    param_reply(p[0], p[1]);
+    return 1;
+  case PARAM_CMD_SAVE:
+    if (len != 0) return 0;
+    task_post(TASK_PARAM_SAVE);
+    return 1;
+  case PARAM_CMD_DEFAULTS:
+    if (len != 0 || param_commit_pending) return 0;
+    param_copy_defaults(param_shadow);
+    param_shadow_stale = 0;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Swap in a committed shadow bank. For the control interrupt, at the
+ * start of a sample.
+ */
+static inline void param_update(void) {
+  if (param_commit_pending) {
+    int16_t *old = (int16_t *) param_active;
+    param_active = param_shadow;
+    param_shadow = old;
+    param_shadow_stale = 1;
+    param_commit_pending = 0;
+  }
+}
+
+#define PARAM_UPDATE()       param_update()
+#define PARAM_POLL(tasks)    do { if ((tasks) & TASK_PARAM_SAVE)        \
+                                  param_save(); } while (0)
+
+#endif
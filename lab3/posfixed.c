@@ -1,214 +1,133 @@
-#include <avr/io.h>
-#include <avr/interrupt.h>
+/**
+ * Position control with state feedback from an observer that also
+ * estimates the load disturbance, in fixed point. The board program
+ * is in controller.h.
+ */
+
 #include <inttypes.h>
+#include "hal.h"
+#include "satcount.h"
+#include "fixedpoint.h"
+#include "sampling.h"
+#include "coeffs.h"
+
+#define CTRL_INPUT 1    /* Position */
+
+/**
+ * Formats. The coefficients each have their own, chosen by coeffgen
+ * for the sample period (<NAME>_Q in coeffs.h). The input keeps the
+ * ADC_FRAC_BITS of readInputQ(). x1, x2 and eps carry 5 fractional
+ * bits so that the small per-sample increments at short sample periods
+ * are not rounded away. Every row is accumulated in 32 bits with 20
+ * fractional bits and rounded once; the disturbance v, which only
+ * integrates lv * eps, stays in that format between samples.
+ */
+typedef Q_TYPE(ADC_FRAC_BITS) input_t;
+typedef q5_t state_t;
+typedef acc20_t acc_t;
+
+/* Coefficients in RAM, updated over the serial line (see params.h) */
+enum { P_K1, P_K2, P_KR, P_L1, P_L2, P_LV,
+       P_PHI11, P_PHI21, P_GAMMA1, P_GAMMA2, P_COUNT };
+#define PARAM_COUNT P_COUNT
+#include "params.h"
+
+static const int16_t param_values[P_COUNT] PROGMEM = {
+  K1_FX, K2_FX, KR_FX, L1_FX, L2_FX, LV_FX,
+  PHI11_FX, PHI21_FX, GAMMA1_FX, GAMMA2_FX
+};
+#define PARAM_MAGIC (0x7066 ^ SAMPLE_MS)   /* "pf" */
+
+#define k1     ((Q_TYPE(K1_Q)) { P[P_K1] })
+#define k2     ((Q_TYPE(K2_Q)) { P[P_K2] })
+#define kr     ((Q_TYPE(KR_Q)) { P[P_KR] })
+#define l1     ((Q_TYPE(L1_Q)) { P[P_L1] })
+#define l2     ((Q_TYPE(L2_Q)) { P[P_L2] })
+#define lv     ((Q_TYPE(LV_Q)) { P[P_LV] })
 
-#define Q 13
-
-#define k1     26944
-#define k2     14608 
-#define kr     14609
-#define l1     16678
-#define l2     10184
-#define lv     10184 
-
-#define phi11  8142
-#define phi12  0
-#define phi21  2041 
-#define phi22  8192
-#define gamma1 919
-#define gamma2 115
-
-int16_t v = 0;
-int16_t x1 = 0;
-int16_t x2 = 0;
-int16_t u = 0;
-int16_t eps_13 = 0;
-
- /* Controller parameters and variables (add_13 your own code here) */
- 
- int8_t on = 0;                     /* 0=off, 1=on */
- int16_t r = 255;                   /* Reference, corresponds to +5.0 V */
- 
- /** 
-  * Write a character on the serial connection
-  */
- static inline void put_char(char ch){
-   while ((UCSRA & 0x20) == 0) {}; /* Wait until USART Data Register is empty */
-   UDR = ch; /* Write to USART Data Register, sends data via serial cable */
- }
- 
- /**
-  * Write 10-bit output using the PWM generator
-  */
- static inline void writeOutput(int16_t val) {
-   val += 512;
-   OCR1AH = (uint8_t) (val>>8);
-   OCR1AL = (uint8_t) val;
- }
- 
- /**
-  * Read 10-bit input using the AD converter from channel (0 or 1)
-  */
- static inline int16_t readInput(char chan) {
-   uint8_t low, high;
-   ADMUX = 0xc0 + chan;             /* Specify reference voltage and channel */
-   ADCSRA |= 0x40;                  /* Start the conversion */
-   while (ADCSRA & 0x40);           /* Wait for conversion to finish */
-   low = ADCL;                      /* Read input, low byte first! */
-   high = ADCH;                     /* Read input, high byte */
-   return ((high<<8) | low) - 512;  /* 10 bit ADC value [-512..511] */ 
- }  
- 
- /**
-  * Interrupt handler for receiving characters over serial connection
-  * Interrupt occurs when data has been received
-  */
- ISR(USART_RXC_vect){ 
-   switch (UDR) {                   /* USART I/O Data Register */
-   case 's':                        /* Start the controller */
-     put_char('s');
-     on = 1;
-     break;
-   case 't':                        /* Stop the controller */
-     put_char('t');
-     on = 0;
-     break;
-   case 'r':                        /* Change sign of reference */
-     put_char('r');
-     r = -r;
-     break;
-   }
- }
- static inline int16_t add_13(int32_t x, int32_t y){
-    int32_t result = x + y;  
-    if (result > INT16_MAX) {
-        return INT16_MAX;  
-    } else if (result < INT16_MIN) {
-        return INT16_MIN;  
-    }
-    return (int16_t)result;  
+#define phi11  ((Q_TYPE(PHI11_Q)) { P[P_PHI11] })  /* phi12 = 0 and phi22 = 1 are built in */
+#define phi21  ((Q_TYPE(PHI21_Q)) { P[P_PHI21] })
+#define gamma1 ((Q_TYPE(GAMMA1_Q)) { P[P_GAMMA1] })
+#define gamma2 ((Q_TYPE(GAMMA2_Q)) { P[P_GAMMA2] })
+
+/* Saturation count sites (-DSATCOUNT, see satcount.h) */
+enum { SAT_U, SAT_EPS, SAT_UV, SAT_X1, SAT_X2, SAT_V };
+#define SAT_NAMES "u eps uv x1 x2 v"
+
+#include "controller.h"
+
+acc_t v[AXES];
+state_t x1[AXES];
+state_t x2[AXES];
+state_t eps[AXES];
+
+static void ctrl_init(void) {
+  param_init(param_values, PARAM_MAGIC);
 }
-static inline int16_t sub_13(int32_t x, int32_t y){
-    int32_t result =  x - y;  
-    if (result > INT16_MAX) {
-        return INT16_MAX;  
-    } else if (result < INT16_MIN) {
-        return INT16_MIN;  
-    }
-    return (int16_t)result;  
-    
+
+static inline int16_t ctrl_output(uint8_t a, int16_t yq, int16_t r) {
+  const int16_t *P = param_active;
+  acc_t acc = {0};
+  int16_t u;
+
+  SAT_SITE(SAT_U);
+  acc = q_mac(acc, kr, ((q0_t) { r }));
+  acc = q_msc(acc, k1, x1[a]);
+  acc = q_msc(acc, k2, x2[a]);
+  acc = q_acc_sub(acc, v[a]);
+  u = q_conv(q0_t, acc).raw;
+  if(u > 511) { u = 511; SAT_LIMIT(); }
+  else if(u< -512) { u = -512; SAT_LIMIT(); }
+  return u;
 }
-static inline int16_t mul_13(int32_t x, int32_t y){
-    int32_t result = x *y;  
-    result = (result + (1 << (Q - 1))) >> Q;
-    if (result > INT16_MAX) {
-        return INT16_MAX;  
-    } else if (result < INT16_MIN) {
-        return INT16_MIN;  
-    }
-    return (int16_t)result;  
-    
+
+/**
+ * Observer, with the output actually applied (see mode.h)
+ */
+static inline void ctrl_update(uint8_t a, int16_t yq, int16_t r, int16_t u) {
+  const int16_t *P = param_active;
+  input_t Y = {yq};
+  acc_t acc = {0};
+  state_t uv;
+  state_t x1_old = x1[a];
+
+  SAT_SITE(SAT_EPS);
+  eps[a] = q_sub(q_conv(state_t, Y), x2[a]);
+  SAT_SITE(SAT_UV);
+  uv = q_conv(state_t, q_acc_add(v[a], ((q0_t) { u })));
+
+  SAT_SITE(SAT_X1);
+  acc = q_mac(acc, phi11, x1[a]);
+  acc = q_mac(acc, gamma1, uv);
+  x1[a] = q_conv(state_t, q_mac(acc, l1, eps[a]));
+
+  SAT_SITE(SAT_X2);
+  acc = q_mac(((acc_t) {0}), phi21, x1_old);
+  acc = q_acc_add(acc, x2[a]);
+  acc = q_mac(acc, gamma2, uv);
+  x2[a] = q_conv(state_t, q_mac(acc, l2, eps[a]));
+
+  SAT_SITE(SAT_V);
+  v[a] = q_mac(v[a], lv, eps[a]);
+}
+
+static inline void ctrl_track(uint8_t a, int16_t yq, int16_t r) {
+  ctrl_update(a, yq, r, 0);
+}
+
+static inline void ctrl_reset(uint8_t a) {
+  x1[a] = x2[a] = eps[a] = (state_t) {0};
+  v[a] = (acc_t) {0};
+}
+
+static inline void ctrl_snapshot(uint8_t a, int16_t yq, int16_t r, int16_t u) {
+  telemetry_sample(roundInput(yq), r, u, q_conv(q0_t, x1[a]).raw, q_conv(q0_t, x2[a]).raw,
+                   q_conv(q0_t, v[a]).raw, q_conv(q0_t, eps[a]).raw);
 }
 
-static inline int16_t div_13(int32_t x, int32_t y){
-  if (y == 0) return 0;
-  int32_t result = x << Q; 
-  result = result / y;  
-  if (result > INT16_MAX) {
-      return INT16_MAX;  
-  } else if (result < INT16_MIN) {
-      return INT16_MIN;  
-  }
-  return (int16_t)result; 
+static inline void ctrl_states(uint8_t a, double s[4]) {
+  s[0] = q_float(x1[a]);
+  s[1] = q_float(x2[a]);
+  s[2] = q_float(v[a]);
+  s[3] = q_float(eps[a]);
 }
- 
- /**
-  * Interrupt handler for the periodic timer. Interrupts are generated
-  * every 10 ms. The control algorithm is executed every 50 ms.
-  */
- ISR(TIMER2_COMP_vect){
-   static int8_t ctr = 0;
-   if (++ctr < 5) return;
-   ctr = 0;
-   int16_t Y = readInput('1');
-   int32_t scaled_r = r << Q;   // Scale r to Q3.13 format
-   int32_t scaled_Y = Y << Q;
-   if (on) {
-     /* Insert your controller code here */
-
-     int32_t u_temp = sub_13(
-            sub_13(
-                sub_13(
-                    mul_13(kr, r),
-                    mul_13(k1, x1)
-                ),
-                mul_13(k2, x2)
-            ),
-            v
-        );    
-    u = u_temp >> Q;  
-    if(u > 511) u = 511;
-    
-    else if(u< -512) u = -512;
-     writeOutput(u);
-     int16_t x1_old = x1;
-     eps_13 = sub_13(scaled_Y, x2);
-     x1 = add_13(
-        add_13(
-            add_13(
-                mul_13(phi11, x1),
-                mul_13(phi12, x2)),
-            mul_13(gamma1, add_13(u, v))),
-        mul_13(l1, eps_13)
-    );
-     x2 = add_13(
-            add_13(
-                add_13(
-                    mul_13(phi21, x1_old),
-                    mul_13(phi22, x2)),
-                mul_13(gamma2, add_13(u, v))),
-            mul_13(l2, eps_13)
-        );
-     v = add_13(v, mul_13(eps_13, lv));
-     
- 
-   } else {                     
-     writeOutput(0);     /* Off */
-   }
- }
- 
- /**
-  * Main program
-  */
- int main(){
- 
-   /* Set port data directions and configure ADC */
-   DDRB = 0x02;    /* Enable PWM output for ATmega8 */
-   DDRD = 0x20;    /* Enable PWM output for ATmega16 */
-   DDRC = 0x30;    /* Enable time measurement pins */
-   ADCSRA = 0xc7;  /* ADC enable + start + prescaling */
- 
-   /* Timer/Counter configuration */
-   TCCR1A = 0xf3;  /* Timer 1: OC1A & OC1B 10 bit fast PWM */
-   TCCR1B = 0x09;  /* Clock / 1 (i.e. no prescaling) */
- 
-   TCNT2 = 0x00;   /* Timer 2: Reset counter (periodic timer) */
-   TCCR2 = 0x0f;   /* Clock / 1024, clear after compare match (CTC) */
-   OCR2 = 144;     /* Set the output compare register, corresponds to ~100 Hz */
- 
-   /* Configure serial communication */
-   /* Set USART Control and Status Registers */
-   UCSRA = 0x00;   /* USART: */
-   UCSRB = 0x98;   /* USART: RXC enable, Receiver enable, Transmitter enable */
-   UCSRC = 0x86;   /* USART: 8bit, no parity, asynchronous */
-   /* 12bit USART baud rate register (high and low byte) */
-   UBRRH = 0x00;   /* USART: 38400 @ 14.7456MHz */
-   UBRRL = 23;     /* USART: 38400 @ 14.7456MHz */
- 
-   TIMSK = 1<<OCIE2; /* Start periodic timer */
- 
-   sei();          /* Enable interrupts */
- 
-   while (1);
- }
- 
\ No newline at end of file
@@ -0,0 +1,244 @@
+/**
+ * Execution-time profiler for the control interrupt.
+ *
+ * Build with -DPROFILE to enable; otherwise every macro below expands
+ * to nothing and the controllers compile exactly as before.
+ *
+ * On the AVR the time base is built from counters that already run.
+ * Timer1 drives the 10-bit fast PWM at clock/1, so TCNT1 gives the
+ * cycle count modulo 1024 exactly. Timer0 is otherwise unused; it is
+ * started at clock/64 and supplies the next four bits (modulo 16384)
+ * to within a few dozen cycles, which is enough to tell Timer1
+ * periods apart without any alignment between the counters. Timer2
+ * supplies the coarse count in 1024-cycle steps for phases longer
+ * than 16384 cycles. No extra interrupts are used. In a host build
+ * (-DHOST) the same counters are filled in nanoseconds from the
+ * monotonic clock.
+ *
+ * PC4 is high while the controller runs and PC5 toggles once per
+ * control sample, so a scope on the time measurement pins shows the
+ * execution time and the sampling jitter directly.
+ *
+ * Usage in the control interrupt:
+ *   PROF_START();  ... read ...     PROF_MARK(PROF_READ);
+ *                  ... compute ...  PROF_MARK(PROF_COMPUTE);
+ *                  ... write ...    PROF_MARK(PROF_WRITE);  PROF_END();
+ *
+ * Sending 'p' prints min/max/mean per phase and a log2 histogram of
+ * the total time over the serial line, then clears the statistics.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifdef PROFILE
+
+#include <inttypes.h>
+
+#ifdef HOST
+#include <time.h>
+#else
+#include <util/atomic.h>
+#endif
+#include "tasks.h"
+
+#define PROF_READ     0
+#define PROF_COMPUTE  1
+#define PROF_WRITE    2
+#define PROF_PHASES   3
+#define PROF_BUCKETS  20            /* bucket b holds times in [2^(b-1), 2^b) */
+
+typedef struct {
+  uint32_t min, max, sum;
+  uint16_t count;
+} prof_stat_t;
+
+static prof_stat_t prof_phase[PROF_PHASES];
+static prof_stat_t prof_total;
+static uint16_t prof_hist[PROF_BUCKETS];
+static uint32_t prof_t0, prof_tmark;
+#ifndef HOST
+static uint16_t prof_phase0;             /* Timer0 vs Timer1 phase offset */
+#endif
+
+#ifdef HOST
+static inline uint32_t prof_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ts.tv_sec * 1000000000u + (uint32_t) ts.tv_nsec;
+}
+
+static inline uint32_t prof_elapsed(uint32_t from, uint32_t to) {
+  return to - from;
+}
+#else
+/**
+ * Time stamp: bits 0-13 are the cycle count modulo 16384, exact;
+ * bits 16-23 are TCNT2. The Timer0 estimate is rounded to the nearest
+ * value that agrees with TCNT1 in the low ten bits.
+ */
+static inline uint32_t prof_now(void) {
+  uint8_t hi = TCNT2;
+  uint8_t t0 = TCNT0;
+  uint16_t lo = TCNT1;
+  uint16_t g = ((uint16_t) t0 << 6) - prof_phase0 - lo;
+  return ((uint32_t) hi << 16) | ((((g + 512) & 0x3c00) + lo) & 0x3fff);
+}
+
+/**
+ * Cycles between two stamps. The exact count modulo 16384 is extended
+ * with the Timer2 difference, which is good to about +-1100 cycles,
+ * allowing for one Timer2 period roll-over.
+ */
+static inline uint32_t prof_elapsed(uint32_t from, uint32_t to) {
+  uint16_t exact = ((uint16_t) to - (uint16_t) from) & 0x3fff;
+  uint8_t h0 = from >> 16, h1 = to >> 16;
+  uint32_t coarse = (uint32_t) ((h1 >= h0) ? h1 - h0 : h1 + OCR2 + 1 - h0) << 10;
+  return exact + ((coarse - exact + 8192) & ~(uint32_t) 0x3fff);
+}
+#endif
+
+static inline void prof_clear(void) {
+  uint8_t i;
+  for (i = 0; i < PROF_PHASES; i++) {
+    prof_phase[i].min = UINT32_MAX;
+    prof_phase[i].max = prof_phase[i].sum = prof_phase[i].count = 0;
+  }
+  prof_total.min = UINT32_MAX;
+  prof_total.max = prof_total.sum = prof_total.count = 0;
+  for (i = 0; i < PROF_BUCKETS; i++) prof_hist[i] = 0;
+}
+
+static inline void prof_add(prof_stat_t *s, uint32_t d) {
+  if (d < s->min) s->min = d;
+  if (d > s->max) s->max = d;
+  if (s->count == UINT16_MAX) return;   /* saturate instead of wrapping the mean */
+  s->sum += d;
+  s->count++;
+}
+
+/**
+ * Start Timer0, measure its phase against Timer1 and clear the
+ * statistics. Call from main() after the timers are configured,
+ * before sei().
+ */
+static inline void prof_init(void) {
+#ifndef HOST
+  uint8_t t0;
+  TCCR0 = 0x03;                     /* Timer 0: Clock / 64, free running */
+  t0 = TCNT0;
+  prof_phase0 = (((uint16_t) t0 << 6) - TCNT1) & 0x3ff;
+#endif
+  prof_clear();
+}
+
+static inline void prof_start(void) {
+#ifndef HOST
+  PORTC |= 0x10;                    /* PC4 high while the controller runs */
+  PORTC ^= 0x20;                    /* PC5 toggles every control sample */
+#endif
+  prof_t0 = prof_tmark = prof_now();
+}
+
+static inline void prof_mark(uint8_t phase) {
+  uint32_t t = prof_now();
+  prof_add(&prof_phase[phase], prof_elapsed(prof_tmark, t));
+  prof_tmark = t;
+}
+
+static inline void prof_end(void) {
+  uint32_t d = prof_elapsed(prof_t0, prof_tmark);
+  uint8_t b = 0;
+#ifndef HOST
+  PORTC &= ~0x10;
+#endif
+  prof_add(&prof_total, d);
+  while (d && b < PROF_BUCKETS - 1) {
+    d >>= 1;
+    b++;
+  }
+  prof_hist[b]++;
+}
+
+static void prof_put_u32(void (*out)(char), uint32_t x) {
+  char buf[10];
+  uint8_t n = 0;
+  do {
+    buf[n++] = '0' + x % 10;
+    x /= 10;
+  } while (x);
+  while (n) out(buf[--n]);
+}
+
+static void prof_put_str(void (*out)(char), const char *s) {
+  while (*s) out(*s++);
+}
+
+static void prof_put_stat(void (*out)(char), const char *name,
+                          const prof_stat_t *s) {
+  prof_put_str(out, name);
+  prof_put_str(out, " min ");
+  prof_put_u32(out, s->count ? s->min : 0);
+  prof_put_str(out, " max ");
+  prof_put_u32(out, s->max);
+  prof_put_str(out, " mean ");
+  prof_put_u32(out, s->count ? s->sum / s->count : 0);
+  prof_put_str(out, " n ");
+  prof_put_u32(out, s->count);
+  prof_put_str(out, "\r\n");
+}
+
+/**
+ * Print the statistics collected since the last report and clear them.
+ * Runs from main(), so the snapshot is taken with interrupts disabled
+ * and the slow printing happens with them enabled.
+ */
+static void prof_report(void (*out)(char)) {
+  prof_stat_t phase[PROF_PHASES], total;
+  uint16_t hist[PROF_BUCKETS];
+  uint8_t i;
+
+#ifndef HOST
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#endif
+  {
+    for (i = 0; i < PROF_PHASES; i++) phase[i] = prof_phase[i];
+    total = prof_total;
+    for (i = 0; i < PROF_BUCKETS; i++) hist[i] = prof_hist[i];
+    prof_clear();
+  }
+
+  prof_put_stat(out, "read   ", &phase[PROF_READ]);
+  prof_put_stat(out, "compute", &phase[PROF_COMPUTE]);
+  prof_put_stat(out, "write  ", &phase[PROF_WRITE]);
+  prof_put_stat(out, "total  ", &total);
+  for (i = 0; i < PROF_BUCKETS; i++) {
+    if (hist[i] == 0) continue;
+    prof_put_str(out, "<2^");
+    prof_put_u32(out, i);
+    prof_put_str(out, " ");
+    prof_put_u32(out, hist[i]);
+    prof_put_str(out, "\r\n");
+  }
+}
+
+#define PROF_INIT()          prof_init()
+#define PROF_START()         prof_start()
+#define PROF_MARK(phase)     prof_mark(phase)
+#define PROF_END()           prof_end()
+#define PROF_REQUEST()       task_post(TASK_PROFILE)
+#define PROF_POLL(tasks, out) do { if ((tasks) & TASK_PROFILE)         \
+                                  prof_report(out); } while (0)
+
+#else
+
+#define PROF_INIT()
+#define PROF_START()
+#define PROF_MARK(phase)
+#define PROF_END()
+#define PROF_REQUEST()
+#define PROF_POLL(tasks, out)
+
+#endif
+
+#endif
@@ -0,0 +1,208 @@
+/**
+ * Binary reference commands and setpoint profile playback.
+ *
+ * Besides the one-character commands, the controllers accept binary
+ * frames on the serial line, framed like the telemetry (telemetry.h):
+ *
+ *   0xa5 0x5a  command(1)  length(1)  payload(length)  checksum(1)
+ *
+ * checksum is the 8-bit sum of command, length and payload. Multi-byte
+ * values are little-endian int16_t in AD units and are clamped to
+ * [-512..511]. A frame is answered with 'k' if it was accepted and
+ * '?' if not (bad checksum, unknown command or bad payload).
+ *
+ *   REF_CMD_SET   value               set the reference, stop playback
+ *   REF_CMD_LOAD  index, point...     store points from buffer index on
+ *   REF_CMD_PLAY  count, shift, flags play points 0..count-1
+ *   REF_CMD_STOP  -                   stop playback, hold the reference
+ *
+ * A profile (ramp, S-curve, sine sweep, ...) is loaded into the
+ * REF_POINTS-point buffer with LOAD frames and then started with PLAY.
+ * Each point lasts 2^shift control samples, and the reference is
+ * interpolated linearly from one point to the next, so 64 points can
+ * describe a smooth trajectory of up to 8192 samples. Flag REF_LOOP
+ * restarts the profile after the last point; otherwise the last point
+ * is held. The frame constants are in refproto.h, which host tools
+ * share; host/refgen.c generates the frames.
+ *
+ * Other commands go to param_execute() if params.h is included before
+ * this file.
+ *
+ * The decoder never holds on to the one-character commands for long.
+ * After a 0xa5 that is not followed by 0x5a, the second byte is handled
+ * as a command again. A frame that stops arriving is dropped, and
+ * answered with '?', once no byte has come for REF_RX_TIMEOUT, about
+ * 50 ms (REF_TICK(), from the timer interrupt). A 't' or 'f' that was
+ * taken as part of a broken frame is then accepted again when it is
+ * sent a second time.
+ *
+ * The receive interrupt only stores commands. The control interrupt
+ * applies them with REF_UPDATE(r) before it uses the reference, so the
+ * reference only ever changes at a sample boundary. Playback costs the
+ * same few operations on every sample (one index step, one multiply),
+ * independent of the profile, so it does not extend the worst-case
+ * execution time of the control interrupt.
+ */
+
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include <inttypes.h>
+#include "hal.h"
+#include "refproto.h"
+#include "sampling.h"
+
+#define REF_IDLE       0            /* ref_mode */
+#define REF_SET        1
+#define REF_PLAY       2
+
+/* Timer ticks without a byte after which a partial frame is dropped */
+#define REF_RX_TIMEOUT ((uint8_t) (0.05 / SAMPLE_TICK) + 1)
+
+static int16_t ref_buf[REF_POINTS];
+static volatile uint8_t ref_mode = REF_IDLE;
+static int16_t ref_value;           /* pending value for REF_SET */
+static uint8_t ref_count, ref_shift, ref_flags;
+static uint8_t ref_pos, ref_sub;    /* current point, sample within it */
+
+static uint8_t ref_rx_state = 0;
+static uint8_t ref_rx_idle;         /* ticks since the last byte of a frame */
+static uint8_t ref_rx_cmd, ref_rx_len, ref_rx_n, ref_rx_sum;
+static uint8_t ref_rx_buf[REF_PAYLOAD];
+
+static inline int16_t ref_word(const uint8_t *p) {
+  return (int16_t) (p[0] | ((uint16_t) p[1] << 8));
+}
+
+/**
+ * Execute a received frame. Returns 1 if it was valid.
+ */
+static uint8_t ref_execute(uint8_t cmd, const uint8_t *p, uint8_t len) {
+  uint8_t i;
+
+  switch (cmd) {
+  case REF_CMD_SET:
+    if (len != 2) return 0;
+    ref_value = ref_clamp(ref_word(p));
+    ref_mode = REF_SET;
+    return 1;
+  case REF_CMD_LOAD:
+    if (len < 3 || !(len & 1) || p[0] + (len >> 1) > REF_POINTS) return 0;
+    for (i = 0; i < len >> 1; i++) ref_buf[p[0] + i] = ref_clamp(ref_word(p + 1 + 2 * i));
+    return 1;
+  case REF_CMD_PLAY:
+    if (len != 3 || p[0] == 0 || p[0] > REF_POINTS || p[1] > 7) return 0;
+    ref_count = p[0];
+    ref_shift = p[1];
+    ref_flags = p[2];
+    ref_pos = 0;
+    ref_sub = 0;
+    ref_mode = REF_PLAY;
+    return 1;
+  case REF_CMD_STOP:
+    if (len != 0) return 0;
+    ref_mode = REF_IDLE;
+    return 1;
+  }
+#ifdef PARAMS_H
+  return param_execute(cmd, p, len);
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Feed a received byte to the frame decoder. Returns 0 if the byte is
+ * not part of a frame and should be handled as a one-character
+ * command, 1 if it was consumed. Called from the receive interrupt.
+ */
+static inline uint8_t ref_rx(uint8_t ch) {
+  ref_rx_idle = 0;
+  switch (ref_rx_state) {
+  case 0:
+    if (ch != REF_SYNC0) return 0;
+    ref_rx_state = 1;
+    break;
+  case 1:
+    if (ch == REF_SYNC1) ref_rx_state = 2;
+    else if (ch != REF_SYNC0) {
+      ref_rx_state = 0;               /* lone sync byte, ch is a command */
+      return 0;
+    }
+    break;
+  case 2:
+    ref_rx_cmd = ch;
+    ref_rx_sum = ch;
+    ref_rx_state = 3;
+    break;
+  case 3:
+    ref_rx_sum += ch;
+    ref_rx_len = ch;
+    ref_rx_n = 0;
+    if (ch > REF_PAYLOAD) {
+      ref_rx_state = 0;
+      put_char('?');
+    } else {
+      ref_rx_state = ch ? 4 : 5;
+    }
+    break;
+  case 4:
+    ref_rx_sum += ch;
+    ref_rx_buf[ref_rx_n++] = ch;
+    if (ref_rx_n == ref_rx_len) ref_rx_state = 5;
+    break;
+  default:
+    ref_rx_state = 0;
+    if (ch == ref_rx_sum && ref_execute(ref_rx_cmd, ref_rx_buf, ref_rx_len)) put_char('k');
+    else put_char('?');
+    break;
+  }
+  return 1;
+}
+
+/**
+ * Drop a partial frame after REF_RX_TIMEOUT ticks without a byte.
+ * Called from the timer interrupt on every tick, which the receive
+ * interrupt cannot preempt.
+ */
+static inline void ref_tick(void) {
+  if (ref_rx_state && ++ref_rx_idle >= REF_RX_TIMEOUT) {
+    if (ref_rx_state > 1) put_char('?');
+    ref_rx_state = 0;
+  }
+}
+
+#define REF_TICK()     ref_tick()
+
+/**
+ * Next playback point, interpolated. Called once per control sample.
+ */
+static inline int16_t ref_play(void) {
+  uint8_t next = ref_pos + 1;
+  int16_t p0 = ref_buf[ref_pos], p1;
+  int16_t x;
+
+  if (next == ref_count) next = (ref_flags & REF_LOOP) ? 0 : ref_pos;
+  p1 = ref_buf[next];
+  x = p0 + (int16_t) (((int32_t) (p1 - p0) * ref_sub) >> ref_shift);
+
+  if (++ref_sub == (uint8_t) (1 << ref_shift)) {
+    ref_sub = 0;
+    if (next == ref_pos) ref_mode = REF_IDLE;   /* held the last point */
+    ref_pos = next;
+  }
+  return x;
+}
+
+/**
+ * Apply a pending SET or the next playback point to the reference r.
+ * For the control interrupt, before r is used.
+ */
+#define REF_UPDATE(r)  do { if (ref_mode == REF_SET) {                     \
+                              r = ref_value;                             \
+                              ref_mode = REF_IDLE;                       \
+                            } else if (ref_mode == REF_PLAY) {           \
+                              r = ref_play();                            \
+                            } } while (0)
+
+#endif
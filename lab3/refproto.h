@@ -0,0 +1,43 @@
+/**
+ * Frame format of the binary reference and parameter commands, see
+ * reference.h and params.h, and of the telemetry frames (telemetry.h).
+ * Shared by the firmware and the host tools, so it depends on nothing
+ * but <inttypes.h>.
+ */
+
+#ifndef REFPROTO_H
+#define REFPROTO_H
+
+#include <inttypes.h>
+
+#ifndef REF_POINTS
+#define REF_POINTS     64
+#endif
+
+#define REF_SYNC0      0xa5
+#define REF_SYNC1      0x5a
+#define REF_PAYLOAD    17           /* LOAD: index + 8 points */
+
+#define REF_CMD_SET    1
+#define REF_CMD_LOAD   2
+#define REF_CMD_PLAY   3
+#define REF_CMD_STOP   4
+
+#define PARAM_CMD_WRITE    5        /* see params.h */
+#define PARAM_CMD_COMMIT   6
+#define PARAM_CMD_READ     7
+#define PARAM_CMD_SAVE     8
+#define PARAM_CMD_DEFAULTS 9
+
+#define TELEMETRY_CMD_DATA 16       /* sent by the controller, telemetry.h */
+#define LOG_CMD_RECORD     17       /* sent by the controller, logger.h */
+
+#define REF_LOOP       0x01         /* PLAY flags */
+
+static inline int16_t ref_clamp(int16_t x) {
+  if (x > 511) return 511;
+  if (x < -512) return -512;
+  return x;
+}
+
+#endif
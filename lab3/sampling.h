@@ -0,0 +1,42 @@
+/**
+ * Controller sample period.
+ *
+ * Build with -DSAMPLE_MS=<period in ms>, one of 50 (the default and
+ * the original design), 20, 10, 5 or 2; coeffs.h has the controller
+ * coefficients for each of them. Timer2 runs at 14745600/1024 = 14400
+ * Hz. For periods of 10 ms and longer the 10 ms tick is kept and the
+ * control law runs every SAMPLE_DIV ticks; shorter periods shorten the
+ * tick itself and run the control law on every tick.
+ *
+ * With two axes (hal.h) each axis runs on a tick of its own, so the
+ * period must be at least AXES ticks: SAMPLE_MS of 20 or more. The
+ * cascade controller (cascfixed.c), whose inner loop needs 10 ms or
+ * less, therefore only builds with one axis.
+ *
+ * The AD conversions (adc.h) oversample less at short periods, so that
+ * every control period still reads a fresh value.
+ *
+ * The binary telemetry (telemetry.h) needs 63 bytes per 4 samples,
+ * which 38400 baud carries down to about 5 ms; at shorter periods
+ * frames are dropped.
+ */
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#ifndef SAMPLE_MS
+#define SAMPLE_MS 50
+#endif
+
+#if SAMPLE_MS >= 10
+#define SAMPLE_OCR2  144            /* ~100 Hz tick, as in the lab skeleton */
+#define SAMPLE_DIV   (SAMPLE_MS / 10)
+#else
+#define SAMPLE_OCR2  ((SAMPLE_MS * 144 + 5) / 10 - 1)
+#define SAMPLE_DIV   1
+#endif
+
+#define SAMPLE_TICK  ((SAMPLE_OCR2 + 1) / 14400.0)  /* tick period, s */
+#define SAMPLE_H     (SAMPLE_MS / 1000.0)           /* design period, s */
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * Saturation counters for the fixed-point arithmetic.
+ *
+ * Build with -DSATCOUNT to enable; otherwise every macro below expands
+ * to nothing and the kernels in fixedpoint.h clamp silently as before.
+ * A fixed-point controller includes this file before fixedpoint.h,
+ * which only sees SAT_EVENT(), so that the math library does not
+ * depend on the board code.
+ *
+ * The controller names the term it is about to compute with
+ * SAT_SITE(site) before each update, and every kernel that clamps a
+ * result (16-bit add/subtract, rounding of an accumulator, 32-bit
+ * accumulator overflow) counts one event for the current site. Naming
+ * a site is a single byte store; the count itself only runs on the
+ * clamping path. Counts stick at 65535.
+ *
+ * The output limit at +511/-512 is not an arithmetic overflow, and is
+ * counted on its own with SAT_LIMIT(), once per clamped sample.
+ *
+ * The controller lists its sites as an enum starting at 0 and their
+ * names, separated by spaces, in SAT_NAMES, e.g.
+ *   enum { SAT_U, SAT_X1 };
+ *   #define SAT_NAMES "u x1"
+ *
+ * Sending 'o' prints the counts since the last report over the serial
+ * line, e.g. "sat u 0 x1 12 limit 40", then clears them.
+ */
+
+#ifndef SATCOUNT_H
+#define SATCOUNT_H
+
+#ifdef SATCOUNT
+
+#include <inttypes.h>
+#include "hal.h"
+#include "tasks.h"
+
+#define SAT_SITES 8
+
+static uint8_t sat_site;
+static uint16_t sat_count[SAT_SITES];
+static uint16_t sat_limit;                   /* samples with the output limited */
+
+static inline void sat_event(void) {
+  if (sat_count[sat_site] != UINT16_MAX) sat_count[sat_site]++;
+}
+
+static inline void sat_limit_event(void) {
+  if (sat_limit != UINT16_MAX) sat_limit++;
+}
+
+/**
+ * Print the counts of the sites named in names and clear them. Runs
+ * from main(), like prof_report(). Inline only so that controllers
+ * without count sites do not warn about it.
+ */
+static inline void sat_report(void (*out)(char), const char *names) {
+  uint16_t count[SAT_SITES], limit;
+  uint8_t i;
+  const char *s;
+
+  UART_ATOMIC {
+    for (i = 0; i < SAT_SITES; i++) {
+      count[i] = sat_count[i];
+      sat_count[i] = 0;
+    }
+    limit = sat_limit;
+    sat_limit = 0;
+  }
+
+  out('s');
+  out('a');
+  out('t');
+  for (i = 0; i < SAT_SITES && *names; i++) {
+    out(' ');
+    while (*names == ' ') names++;
+    while (*names && *names != ' ') out(*names++);
+    out(' ');
+    uart_put_u16(out, count[i]);
+  }
+  for (s = " limit "; *s; s++) out(*s);
+  uart_put_u16(out, limit);
+  out('\r');
+  out('\n');
+}
+
+#define SAT_SITE(site)       (sat_site = (site))
+#undef SAT_EVENT                /* empty if fixedpoint.h came first */
+#define SAT_EVENT()          sat_event()
+#define SAT_LIMIT()          sat_limit_event()
+#define SAT_REQUEST()        task_post(TASK_SATCOUNT)
+#define SAT_POLL(tasks, out) do { if ((tasks) & TASK_SATCOUNT)          \
+                                  sat_report(out, SAT_NAMES); } while (0)
+
+#else
+
+#define SAT_SITE(site)
+#ifndef SAT_EVENT
+#define SAT_EVENT()
+#endif
+#define SAT_LIMIT()
+#define SAT_REQUEST()
+#define SAT_POLL(tasks, out)
+
+#endif
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * Background tasks of main() and the idle loop between them.
+ *
+ * The interrupt handlers keep only the work that is tied to a sample
+ * or a received byte. Whatever can wait a little, sending a telemetry
+ * frame, the reports, the EEPROM save and the logger dump, they post
+ * as a task bit with task_post(). main() takes all pending bits at
+ * once with task_take(), runs the tasks (ctrl_background() in
+ * controller.h) and then puts the CPU to sleep with task_idle() until
+ * the next interrupt.
+ *
+ * The sleep mode is Idle: it stops only the CPU clock, so Timer1 keeps
+ * driving the PWM and Timer2, the ADC and the USART keep running and
+ * wake the CPU with their interrupts. The CPU is then awake for the
+ * interrupt handlers and the tasks and asleep for the rest, including
+ * the timer ticks that are not a control sample and the ADC
+ * interrupts, which only go back to sleep. task_idle() checks for
+ * pending tasks with interrupts off and enables them in the
+ * instruction before sleep, which the AVR always executes first, so a
+ * task posted just before cannot be left waiting until the next
+ * interrupt.
+ *
+ * A task posted again before main() gets to it runs once. In a host
+ * build (-DHOST) task_idle() does nothing; host/servosim.c runs the
+ * tasks after every tick.
+ */
+
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <inttypes.h>
+
+#ifndef HOST
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#define TASK_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+#define TASK_ATOMIC
+#endif
+
+#define TASK_TELEMETRY  0x01        /* send the completed frame, telemetry.h */
+#define TASK_UART       0x02        /* 'u': transmit queue statistics */
+#define TASK_PROFILE    0x04        /* 'p': profile report, profiler.h */
+#define TASK_SATCOUNT   0x08        /* 'o': saturation report, satcount.h */
+#define TASK_PARAM_SAVE 0x10        /* store the coefficients in EEPROM, params.h */
+#define TASK_LOGGER     0x20        /* send the frozen window, logger.h */
+
+static volatile uint8_t task_pending = 0;
+
+/**
+ * Post tasks for main(). Only for interrupt handlers, which the AVR
+ * does not nest, so the read-modify-write needs no protection.
+ */
+static inline void task_post(uint8_t tasks) {
+  task_pending |= tasks;
+}
+
+/**
+ * Take and clear all pending tasks. For main().
+ */
+static inline uint8_t task_take(void) {
+  uint8_t tasks;
+  TASK_ATOMIC {
+    tasks = task_pending;
+    task_pending = 0;
+  }
+  return tasks;
+}
+
+/**
+ * Select the sleep mode. Called once from main().
+ */
+static inline void task_init(void) {
+#ifndef HOST
+  set_sleep_mode(SLEEP_MODE_IDLE);
+#endif
+}
+
+/**
+ * Sleep until the next interrupt unless a task is pending. For main().
+ */
+static inline void task_idle(void) {
+#ifndef HOST
+  cli();
+  if (!task_pending) {
+    sleep_enable();
+    sei();                          /* the sleep below still runs first */
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
+#endif
+}
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * Binary telemetry stream of the controller samples over the USART.
+ *
+ * When enabled with the 'b' command, every control sample is packed
+ * into a 14-byte record and TELEMETRY_BATCH records are sent as one
+ * frame:
+ *
+ *   0xa5 0x5a  TELEMETRY_CMD_DATA(1)  length(1)  index(2)  record * n
+ *   checksum(1)
+ *
+ * It is a frame of refproto.h, like the parameter replies of params.h
+ * and the logger records of logger.h on the same line, so a host tells
+ * them apart by the command byte and skips a frame it does not want by
+ * its length. length is
+ * 2 + 14 n, index the sample number of the first record and checksum
+ * the 8-bit sum of all bytes after the sync pair. A record is seven
+ * little-endian int16_t: Y, r, u followed by four controller states
+ * (x1, x2, v, eps for the position controllers, I and zeros for the
+ * velocity controllers, vel, vref, I and zero for the cascade). Every
+ * field is in input units, the integer AD/PWM counts of Y, r and u:
+ * the controllers round their states to them, whatever format they
+ * keep them in (telemetry_state() for the floating-point ones), so a
+ * field means the same whichever controller is flashed. In the
+ * identification mode (ident.h) a record is vel, pos, u, the running
+ * sum of u and zeros, vel and pos with ADC_FRAC_BITS fractional bits.
+ *
+ * The control interrupt only packs the records into one of two frame
+ * buffers. When a frame is complete it posts TASK_TELEMETRY (tasks.h)
+ * and goes on with the other buffer; main() adds the checksum and
+ * hands the frame to the transmit queue (uart.h) in one piece, so the
+ * interrupt never sums or copies a frame, nothing waits for the serial
+ * line and other output cannot end up inside a frame. A frame is
+ * dropped and counted in telemetry_dropped if the queue does not have
+ * room for all of it, or if main() has not sent the previous one when
+ * it is complete. The second buffer costs 63 bytes of RAM.
+ *
+ * With TELEMETRY_BATCH 4 a frame is 63 bytes every 200 ms, 315 of the
+ * 3840 bytes/s that 38400 baud can carry.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <inttypes.h>
+#include "hal.h"
+#include "refproto.h"
+#include "logger.h"
+#include "tasks.h"
+
+#define TELEMETRY_BATCH    4
+#define TELEMETRY_RECORD   14
+#define TELEMETRY_LENGTH   (2 + TELEMETRY_BATCH * TELEMETRY_RECORD)
+#define TELEMETRY_FRAME    (4 + TELEMETRY_LENGTH + 1)
+
+static uint8_t telemetry_buf[2][TELEMETRY_FRAME];
+static uint8_t *telemetry_frame = telemetry_buf[0];  /* frame being filled */
+static uint8_t *volatile telemetry_ready = 0;        /* frame waiting for main() */
+static uint8_t telemetry_wr;                 /* write position in the frame */
+static uint8_t telemetry_fill = 0;           /* records in the current frame */
+static uint8_t telemetry_on = 0;
+static uint16_t telemetry_index = 0;
+static uint16_t telemetry_dropped = 0;
+
+static inline void telemetry_byte(uint8_t b) {
+  telemetry_frame[telemetry_wr++] = b;
+}
+
+static inline void telemetry_word(int16_t w) {
+  telemetry_byte((uint8_t) w);
+  telemetry_byte((uint8_t) ((uint16_t) w >> 8));
+}
+
+/**
+ * Start or stop the stream. A partly written frame is discarded.
+ */
+static inline void telemetry_toggle(void) {
+  telemetry_on = !telemetry_on;
+  telemetry_fill = 0;
+}
+
+/**
+ * Start the stream if it is not running
+ */
+static inline void telemetry_start(void) {
+  if (!telemetry_on) telemetry_toggle();
+}
+
+/**
+ * A floating-point state rounded to input units for telemetry_sample(),
+ * saturated to int16_t
+ */
+static inline int16_t telemetry_state(float x) {
+  if (x >= INT16_MAX) return INT16_MAX;
+  if (x <= INT16_MIN) return INT16_MIN;
+  return (int16_t) (x < 0 ? x - 0.5f : x + 0.5f);
+}
+
+/**
+ * Record one control sample, the states in input units. Called from
+ * the control interrupt.
+ */
+static inline void telemetry_sample(int16_t y, int16_t r, int16_t u,
+                                    int16_t s0, int16_t s1, int16_t s2,
+                                    int16_t s3) {
+  uint16_t index = telemetry_index++;
+  LOG_SAMPLE(index, y, r, u, s0);  /* Ring-buffer logger, see logger.h */
+  if (!telemetry_on) return;
+
+  if (telemetry_fill == 0) {
+    telemetry_frame[0] = REF_SYNC0;
+    telemetry_frame[1] = REF_SYNC1;
+    telemetry_frame[2] = TELEMETRY_CMD_DATA;
+    telemetry_frame[3] = TELEMETRY_LENGTH;
+    telemetry_wr = 4;
+    telemetry_word(index);
+  }
+
+  telemetry_word(y);
+  telemetry_word(r);
+  telemetry_word(u);
+  telemetry_word(s0);
+  telemetry_word(s1);
+  telemetry_word(s2);
+  telemetry_word(s3);
+
+  if (++telemetry_fill == TELEMETRY_BATCH) {
+    telemetry_fill = 0;
+    if (telemetry_ready) {
+      telemetry_dropped++;                   /* refill this buffer */
+    } else {
+      telemetry_ready = telemetry_frame;
+      telemetry_frame = telemetry_buf[telemetry_frame == telemetry_buf[0]];
+      task_post(TASK_TELEMETRY);
+    }
+  }
+}
+
+/**
+ * Add the checksum to the completed frame and queue it. Runs from
+ * main() as TASK_TELEMETRY. The pointer is two bytes on the AVR, so it
+ * is taken and cleared in one atomic block. The control interrupt
+ * then fills the other buffer and comes back to this one only after
+ * TELEMETRY_BATCH samples, long after the frame has been copied into
+ * the transmit queue.
+ */
+static void telemetry_send(void) {
+  uint8_t *p;
+  uint8_t i, sum = 0;
+
+  TASK_ATOMIC {
+    p = telemetry_ready;
+    telemetry_ready = 0;
+  }
+  if (!p) return;
+  for (i = 2; i < TELEMETRY_FRAME - 1; i++) sum += p[i];
+  p[TELEMETRY_FRAME - 1] = sum;
+  if (!uart_write(p, TELEMETRY_FRAME)) {
+    TASK_ATOMIC {
+      telemetry_dropped++;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ * Interrupt-driven USART transmit queue.
+ *
+ * Bytes are queued in a ring buffer and sent by the USART data
+ * register empty interrupt, so no caller ever waits for the serial
+ * line. The ring is single-producer/single-consumer: the UDRE
+ * interrupt is the only consumer and touches only the tail; producers
+ * touch only the head. Producers in interrupt handlers are serialized
+ * by the AVR not nesting interrupts; a producer in main() is made
+ * atomic by the ATOMIC_BLOCK around the head update, which inside an
+ * interrupt handler costs only an SREG save and restore.
+ *
+ * When the ring is full, uart_put() and uart_write() drop the data and
+ * count it in uart_tx_dropped. uart_tx_highwater is the largest number
+ * of bytes that have been queued at once, for sizing UART_TX_SIZE.
+ * uart_put_wait() and uart_write_wait() instead wait for room and may
+ * only be used from main(), e.g. for long reports.
+ */
+
+#ifndef UART_H
+#define UART_H
+
+#include <inttypes.h>
+
+#ifndef HOST
+#include <util/atomic.h>
+#define UART_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+#define UART_ATOMIC
+#endif
+
+#define UART_TX_SIZE  128           /* power of two */
+#define UART_TX_MASK  (UART_TX_SIZE - 1)
+#define UDRIE_BIT     5             /* UCSRB: data register empty interrupt */
+
+static uint8_t uart_tx_buf[UART_TX_SIZE];
+static volatile uint8_t uart_tx_head = 0;
+static volatile uint8_t uart_tx_tail = 0;
+static volatile uint16_t uart_tx_dropped = 0;
+static volatile uint8_t uart_tx_highwater = 0;
+
+/**
+ * Queue n bytes, all or nothing. Returns 1 if queued, 0 if there was
+ * no room; drop counts that with drop set.
+ */
+static inline uint8_t uart_queue(const uint8_t *p, uint8_t n, uint8_t drop) {
+  uint8_t ok = 0;
+  UART_ATOMIC {
+    uint8_t head = uart_tx_head;
+    uint8_t used = (head - uart_tx_tail) & UART_TX_MASK;
+    if ((uint8_t) (UART_TX_SIZE - 1 - used) < n) {
+      if (drop) uart_tx_dropped += n;
+    } else {
+      uint8_t i;
+      for (i = 0; i < n; i++) {
+        uart_tx_buf[head] = p[i];
+        head = (head + 1) & UART_TX_MASK;
+      }
+      uart_tx_head = head;         /* publish */
+      used += n;
+      if (used > uart_tx_highwater) uart_tx_highwater = used;
+      UCSRB |= 1 << UDRIE_BIT;
+      ok = 1;
+    }
+  }
+  return ok;
+}
+
+/**
+ * Queue n bytes, all or nothing. Returns 1 if queued, 0 if dropped.
+ */
+static inline uint8_t uart_write(const uint8_t *p, uint8_t n) {
+  return uart_queue(p, n, 1);
+}
+
+/**
+ * Queue n bytes in one piece, waiting for room. Only for main(), and
+ * n must be less than UART_TX_SIZE.
+ */
+static inline void uart_write_wait(const uint8_t *p, uint8_t n) {
+  while (!uart_queue(p, n, 0)) {}
+}
+
+static inline uint8_t uart_put(char ch) {
+  return uart_write((const uint8_t *) &ch, 1);
+}
+
+/**
+ * Queue a byte, waiting for room. Only for main().
+ */
+static inline void uart_put_wait(char ch) {
+  while (!uart_queue((const uint8_t *) &ch, 1, 0)) {}
+}
+
+static void uart_put_u16(void (*out)(char), uint16_t x) {
+  char buf[5];
+  uint8_t n = 0;
+  do {
+    buf[n++] = '0' + x % 10;
+    x /= 10;
+  } while (x);
+  while (n) out(buf[--n]);
+}
+
+/**
+ * Print the queue statistics: dropped bytes and high-water mark
+ */
+static void uart_report(void (*out)(char)) {
+  const char *s;
+  uint16_t dropped;
+  uint8_t highwater;
+  UART_ATOMIC {
+    dropped = uart_tx_dropped;
+    highwater = uart_tx_highwater;
+  }
+  for (s = "tx dropped "; *s; s++) out(*s);
+  uart_put_u16(out, dropped);
+  for (s = " highwater "; *s; s++) out(*s);
+  uart_put_u16(out, highwater);
+  out('\r');
+  out('\n');
+}
+
+/**
+ * Interrupt handler for the USART data register empty condition.
+ * Sends the next byte, and switches itself off when the ring is empty.
+ */
+ISR(USART_UDRE_vect){
+  uint8_t tail = uart_tx_tail;
+  if (tail == uart_tx_head) {
+    UCSRB &= ~(1 << UDRIE_BIT);
+    return;
+  }
+  UDR = uart_tx_buf[tail];
+  uart_tx_tail = (tail + 1) & UART_TX_MASK;
+}
+
+#endif
@@ -1,172 +1,107 @@
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <inttypes.h>
-#define Q 13
-#define KB     10704
-#define Kh_Ti 2367
-#define INT16_MAX 32767
-#define INT16_MIN -32768
-
-
-/* Controller parameters and variables (add your own code here) */
- 
-int8_t on = 0;                     /* 0=off, 1=on */
-int16_t r = 255;                   /* Reference, corresponds to +5.0 V */
-int16_t u = 0;
-int16_t I = 0;
-/** 
- * Write a character on the serial connection
- */
-static inline void put_char(char ch){
-  while ((UCSRA & 0x20) == 0) {}; /* Wait until USART Data Register is empty */
-  UDR = ch; /* Write to USART Data Register, sends data via serial cable */
-}
-
 /**
- * Write 10-bit output using the PWM generator
+ * Velocity control with a PI controller with set-point weighting, in
+ * fixed point. The board program is in controller.h.
  */
-static inline void writeOutput(int16_t val) {
-  val += 512;
-  OCR1AH = (uint8_t) (val>>8);
-  OCR1AL = (uint8_t) val;
-}
 
-/**
- * Read 10-bit input using the AD converter from channel (0 or 1)
- */
-static inline int16_t readInput(char chan) {
-  uint8_t low, high;
-  ADMUX = 0xc0 + chan;             /* Specify reference voltage and channel */
-  ADCSRA |= 0x40;                  /* Start the conversion */
-  while (ADCSRA & 0x40);           /* Wait for conversion to finish */
-  low = ADCL;                      /* Read input, low byte first! */
-  high = ADCH;                     /* Read input, high byte */
-  return ((high<<8) | low) - 512;  /* 10 bit ADC value [-512..511] */ 
-}  
+#include <inttypes.h>
+#include "hal.h"
+#include "satcount.h"
+#include "fixedpoint.h"
+#include "sampling.h"
+#include "coeffs.h"
+
+#define CTRL_INPUT 0    /* Velocity */
 
 /**
- * Interrupt handler for receiving characters over serial connection
- * Interrupt occurs when data has been received
+ * Formats. The coefficients each have their own, chosen by coeffgen
+ * for the sample period (<NAME>_Q in coeffs.h), and the input keeps
+ * the ADC_FRAC_BITS of readInputQ(). The integral and the unlimited
+ * output are 32 bits with 20 fractional bits, so that the integral
+ * still moves at short sample periods, where K*h/Ti is small.
  */
-ISR(USART_RXC_vect){ 
-  switch (UDR) {                   /* USART I/O Data Register */
-  case 's':                        /* Start the controller */
-    put_char('s');
-    on = 1;
-    break;
-  case 't':                        /* Stop the controller */
-    put_char('t');
-    on = 0;
-    break;
-  case 'r':                        /* Change sign of reference */
-    put_char('r');
-    r = -r;
-    break;
-  }
-}
+typedef Q_TYPE(ADC_FRAC_BITS) input_t;
+typedef q5_t state_t;
+typedef acc20_t acc_t;
 
-static inline int16_t add_13(int32_t x, int32_t y){
-  int32_t result = x + y;  
-  if (result > INT16_MAX) {
-      return INT16_MAX;  
-  } else if (result < INT16_MIN) {
-      return INT16_MIN;  
-  }
-  return (int16_t)result;  
-}
-static inline int16_t sub_13(int32_t x, int32_t y){
-  int32_t result =  x - y;  
-  if (result > INT16_MAX) {
-      return INT16_MAX;  
-  } else if (result < INT16_MIN) {
-      return INT16_MIN;  
-  }
-  return (int16_t)result;  
-  
-}
-static inline int16_t mul_13(int32_t x, int32_t y){
-  int32_t result = x *y;  
-  result = (result + (1 << (Q - 1))) >> Q;
-  if (result > INT16_MAX) {
-      return INT16_MAX;  
-  } else if (result < INT16_MIN) {
-      return INT16_MIN;  
-  }
-  return (int16_t)result;  
-  
-}
+/* Coefficients in RAM, updated over the serial line (see params.h) */
+enum { P_K, P_KB, P_KH_TI, P_H_TR, P_COUNT };
+#define PARAM_COUNT P_COUNT
+#include "params.h"
 
-static inline int16_t div_13(int32_t x, int32_t y){
-if (y == 0) return 0;
-int32_t result = x << Q; 
-result = result / y;  
-if (result > INT16_MAX) {
-    return INT16_MAX;  
-} else if (result < INT16_MIN) {
-    return INT16_MIN;  
-}
-return (int16_t)result; 
+static const int16_t param_values[P_COUNT] PROGMEM = {
+  PI_K_FX, PI_KB_FX, KH_TI_FX, H_TR_FX
+};
+#define PARAM_MAGIC (0x7666 ^ SAMPLE_MS)   /* "vf" */
+
+#define K      ((Q_TYPE(PI_K_Q)) { P[P_K] })
+#define KB     ((Q_TYPE(PI_KB_Q)) { P[P_KB] })
+#define Kh_Ti  ((Q_TYPE(KH_TI_Q)) { P[P_KH_TI] })
+#define H_Tr   ((Q_TYPE(H_TR_Q)) { P[P_H_TR] })
+
+/* Saturation count sites (-DSATCOUNT, see satcount.h) */
+enum { SAT_U, SAT_I };
+#define SAT_NAMES "u I"
+
+#include "controller.h"
+
+acc_t I[AXES];          /* Integral */
+static acc_t vq[AXES];  /* Unlimited output */
+
+static void ctrl_init(void) {
+  param_init(param_values, PARAM_MAGIC);
 }
 
+static inline int16_t ctrl_output(uint8_t a, int16_t yq, int16_t r) {
+  const int16_t *P = param_active;
+  input_t Y = {yq};
+  acc_t acc = {0};
+  int16_t u;
+
+  SAT_SITE(SAT_U);
+  acc = q_mac(acc, KB, ((q0_t) { r }));
+  acc = q_msc(acc, K, Y);
+  vq[a] = q_acc_add(acc, I[a]);
+  u = q_conv(q0_t, vq[a]).raw;
+  if(u > 511) { u = 511; SAT_LIMIT(); }
+  else if(u< -512) { u = -512; SAT_LIMIT(); }
+  return u;
+}
 
 /**
- * Interrupt handler for the periodic timer. Interrupts are generated
- * every 10 ms. The control algorithm is executed every 50 ms.
+ * Integral with back-calculation anti-windup (see mode.h)
  */
-ISR(TIMER2_COMP_vect){
-  static int8_t ctr = 0;
-  if (++ctr < 5) return;
-  ctr = 0;
-  
-  int16_t Y = readInput('0');
-  int32_t scaled_r = r << 13;   // Scale r to Q3.13 format
-  int32_t scaled_Y = Y << 13;
-  if (on) {
-    /* Insert your controller code here */
-    int32_t u_temp =  add_13(sub_13(mul_13(KB, scaled_r), mul_13(K, scaled_Y)) , I);
-    u = u_temp >> 13; 
-    if(u > 511) u = 511;
-       
-     else if(u< -512) u = -512;
-    writeOutput(u);
-    I = add_13(I, mul_13(Kh_Ti, sub_13(scaled_r, scaled_Y)));
-
-  } else {                     
-    writeOutput(0);     /* Off */
-  }
+static inline void ctrl_update(uint8_t a, int16_t yq, int16_t r, int16_t u) {
+  const int16_t *P = param_active;
+  input_t Y = {yq};
+  input_t e;
+  state_t w;
+
+  SAT_SITE(SAT_I);
+  e = q_sub(q_conv(input_t, ((q0_t) { r })), Y);
+  w = q_sub(q_conv(state_t, ((q0_t) { u })), q_conv(state_t, vq[a]));
+  I[a] = q_mac(q_mac(I[a], Kh_Ti, e), H_Tr, w);
 }
 
 /**
- * Main program
+ * Output 0 if r were y: the ordinary step response from here on
  */
-int main(){
+static inline void ctrl_track(uint8_t a, int16_t yq, int16_t r) {
+  const int16_t *P = param_active;
+  input_t Y = {yq};
 
-  /* Set port data directions and configure ADC */
-  DDRB = 0x02;    /* Enable PWM output for ATmega8 */
-  DDRD = 0x20;    /* Enable PWM output for ATmega16 */
-  DDRC = 0x30;    /* Enable time measurement pins */
-  ADCSRA = 0xc7;  /* ADC enable + start + prescaling */
-
-  /* Timer/Counter configuration */
-  TCCR1A = 0xf3;  /* Timer 1: OC1A & OC1B 10 bit fast PWM */
-  TCCR1B = 0x09;  /* Clock / 1 (i.e. no prescaling) */
-
-  TCNT2 = 0x00;   /* Timer 2: Reset counter (periodic timer) */
-  TCCR2 = 0x0f;   /* Clock / 1024, clear after compare match (CTC) */
-  OCR2 = 144;     /* Set the output compare register, corresponds to ~100 Hz */
-
-  /* Configure serial communication */
-  /* Set USART Control and Status Registers */
-  UCSRA = 0x00;   /* USART: */
-  UCSRB = 0x98;   /* USART: RXC enable, Receiver enable, Transmitter enable */
-  UCSRC = 0x86;   /* USART: 8bit, no parity, asynchronous */
-  /* 12bit USART baud rate register (high and low byte) */
-  UBRRH = 0x00;   /* USART: 38400 @ 14.7456MHz */
-  UBRRL = 23;     /* USART: 38400 @ 14.7456MHz */
+  SAT_SITE(SAT_I);
+  I[a] = q_msc(q_mac(((acc_t) {0}), K, Y), KB, Y);
+}
 
-  TIMSK = 1<<OCIE2; /* Start periodic timer */
+static inline void ctrl_reset(uint8_t a) {
+  I[a] = (acc_t) {0};
+}
 
-  sei();          /* Enable interrupts */
+static inline void ctrl_snapshot(uint8_t a, int16_t yq, int16_t r, int16_t u) {
+  telemetry_sample(roundInput(yq), r, u, q_conv(q0_t, I[a]).raw, 0, 0, 0);
+}
 
-  while (1);
+static inline void ctrl_states(uint8_t a, double s[4]) {
+  s[0] = q_float(I[a]);
+  s[1] = s[2] = s[3] = 0;
 }